@@ -0,0 +1,112 @@
+##*****************************************************************************
+#  SYNOPSIS:
+#    X_AC_CHECK_SIMD
+#
+#  DESCRIPTION:
+#    Check whether the compiler can build functions for instruction set
+#    extensions selected at runtime via __attribute__((target(...))).
+#    Nothing is added to CFLAGS; code using these must check the CPU
+#    before calling into it.
+##*****************************************************************************
+
+AC_DEFUN([X_AC_CHECK_SIMD], [
+  AC_CACHE_CHECK(
+    [whether the compiler supports AES-NI intrinsics],
+    [x_ac_cv_have_aesni], [
+      AC_COMPILE_IFELSE([
+        AC_LANG_PROGRAM(
+          [[#include <immintrin.h>
+            __attribute__((target("aes,sse2")))
+            __m128i f(__m128i a, __m128i k) { return _mm_aesenc_si128(a, k); }]],
+          [[]]
+        )],
+        [x_ac_cv_have_aesni=yes],
+        [x_ac_cv_have_aesni=no]
+      )]
+  )
+  if test "$x_ac_cv_have_aesni" = "yes"; then
+    AC_DEFINE([HAVE_AESNI], [1],
+      [Define to 1 if the compiler supports AES-NI intrinsics.]
+    )
+  fi
+
+  AC_CACHE_CHECK(
+    [whether the compiler supports VAES/AVX-512 intrinsics],
+    [x_ac_cv_have_vaes], [
+      AC_COMPILE_IFELSE([
+        AC_LANG_PROGRAM(
+          [[#include <immintrin.h>
+            __attribute__((target("aes,vaes,avx512f")))
+            __m512i f(__m512i a, __m512i k) { return _mm512_aesenc_epi128(a, k); }]],
+          [[]]
+        )],
+        [x_ac_cv_have_vaes=yes],
+        [x_ac_cv_have_vaes=no]
+      )]
+  )
+  if test "$x_ac_cv_have_vaes" = "yes"; then
+    AC_DEFINE([HAVE_VAES], [1],
+      [Define to 1 if the compiler supports VAES/AVX-512 intrinsics.]
+    )
+  fi
+
+  AC_CACHE_CHECK(
+    [whether the compiler supports SSE2 intrinsics],
+    [x_ac_cv_have_sse2], [
+      AC_COMPILE_IFELSE([
+        AC_LANG_PROGRAM(
+          [[#include <immintrin.h>
+            __attribute__((target("sse2")))
+            __m128i f(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }]],
+          [[]]
+        )],
+        [x_ac_cv_have_sse2=yes],
+        [x_ac_cv_have_sse2=no]
+      )]
+  )
+  if test "$x_ac_cv_have_sse2" = "yes"; then
+    AC_DEFINE([HAVE_SSE2], [1],
+      [Define to 1 if the compiler supports SSE2 intrinsics.]
+    )
+  fi
+
+  AC_CACHE_CHECK(
+    [whether the compiler supports AVX2 intrinsics],
+    [x_ac_cv_have_avx2], [
+      AC_COMPILE_IFELSE([
+        AC_LANG_PROGRAM(
+          [[#include <immintrin.h>
+            __attribute__((target("avx2")))
+            __m256i f(__m256i a, __m256i b) { return _mm256_shuffle_epi8(a, b); }]],
+          [[]]
+        )],
+        [x_ac_cv_have_avx2=yes],
+        [x_ac_cv_have_avx2=no]
+      )]
+  )
+  if test "$x_ac_cv_have_avx2" = "yes"; then
+    AC_DEFINE([HAVE_AVX2], [1],
+      [Define to 1 if the compiler supports AVX2 intrinsics.]
+    )
+  fi
+
+  AC_CACHE_CHECK(
+    [whether the compiler supports AVX-512F intrinsics],
+    [x_ac_cv_have_avx512], [
+      AC_COMPILE_IFELSE([
+        AC_LANG_PROGRAM(
+          [[#include <immintrin.h>
+            __attribute__((target("avx512f")))
+            void f(void *p, __m512i a) { _mm512_stream_si512(p, a); }]],
+          [[]]
+        )],
+        [x_ac_cv_have_avx512=yes],
+        [x_ac_cv_have_avx512=no]
+      )]
+  )
+  if test "$x_ac_cv_have_avx512" = "yes"; then
+    AC_DEFINE([HAVE_AVX512], [1],
+      [Define to 1 if the compiler supports AVX-512F intrinsics.]
+    )
+  fi
+])
@@ -21,12 +21,12 @@
 #include <errno.h>
 
 #include "util.h"
+#include "pattern.h"
 #include "filldentry.h"
 #include "fillfile.h"
 #include "genrand.h"
 #include "getsize.h"
 #include "hwrand.h"
-#include "pattern.h"
 #include "progress.h"
 #include "sig.h"
 
@@ -99,6 +99,29 @@ error:
     return -1;
 }
 
+/* Select the random data generator by name (see scrub(1) --rng).
+ */
+int
+scrub_rng_set (scrub_ctx_t c, const char *name)
+{
+    if (set_rng (name) < 0)
+        goto einval;
+    return 0;
+einval:
+    c->errnum = ESCRUB_INVAL;
+    return -1;
+}
+
+/* Get the random data generator used by the last write and, if 'auto'
+ * picked it, its measured rate in GB/s (else 0).
+ */
+int
+scrub_rng_get (scrub_ctx_t c, const char **namep, double *gbps)
+{
+    *namep = rng_info (gbps);
+    return 0;
+}
+
 int
 scrub_attr_set (scrub_ctx_t c, scrub_attr_t attr, int val)
 {
@@ -142,6 +165,7 @@ scrub(char *path, off_t size, const sequence_t *seq, bool sparse,
     unsigned char *buf;
     int bufsize = BUFSIZE;
     off_t written, checked;
+    size_t mismatch;
     scrub_errnum_t errnum = ESCRUB_SUCCESS;
 
     if (!(buf = alloc_buffer(bufsize))) {
@@ -158,7 +182,7 @@ scrub(char *path, off_t size, const sequence_t *seq, bool sparse,
 
                 written = fillfile(path, size, buf, bufsize,
                                    (progress_t) progress_update, p,
-                                   (refill_t) genrand, sparse, enospc);
+                                   genrand_at, sparse, enospc);
 
                 progress_destroy(p);
                 COND_ESCRUB_ERROR(written == (off_t) -1);
@@ -187,7 +211,8 @@ scrub(char *path, off_t size, const sequence_t *seq, bool sparse,
                 progress_create(&p, 50);
 
                 checked = checkfile(path, written, buf, bufsize,
-                                    (progress_t) progress_update, p, sparse);
+                                    (progress_t) progress_update, p,
+                                    NULL, &seq->pat[i], sparse, &mismatch);
 
                 progress_destroy(p);
                 COND_ESCRUB_ERROR(checked == (off_t) -1);
@@ -45,6 +45,10 @@ int   scrub_path_set (scrub_ctx_t c, const char *path);
 
 int   scrub_path_get (scrub_ctx_t c, const char **pathp);
 
+int   scrub_rng_set (scrub_ctx_t c, const char *name);
+
+int   scrub_rng_get (scrub_ctx_t c, const char **namep, double *gbps);
+
 int   scrub_write (scrub_ctx_t c,
                    void (*progress_cb)(void *arg, double pct_done),
                    void *arg);
@@ -23,6 +23,7 @@ usage(void)
 "Usage: tscrub [OPTIONS] [FILE...]\n"
 "  -X dir     create dir+files, fill until ENOSPC, then scrub\n"
 "  -p n       select pattern sequence number\n"
+"  -g name    select random data generator\n"
     );
     exit(1);
 }
@@ -92,8 +93,9 @@ main (int argc, char *argv[])
     scrub_ctx_t c;
     int i, il;
     int method = 4; /* default method 4 = one random pass */
+    char *rng = NULL;
 
-    while ((f = getopt (argc, argv, "X:p:")) != -1) {
+    while ((f = getopt (argc, argv, "X:p:g:")) != -1) {
         switch (f) {
             case 'X':
                 dirpath = optarg;
@@ -101,6 +103,9 @@ main (int argc, char *argv[])
             case 'p':
                 method = strtoul (optarg, NULL, 10);
                 break;
+            case 'g':
+                rng = optarg;
+                break;
             default:
                 usage();
                 exit(1);
@@ -120,6 +125,10 @@ main (int argc, char *argv[])
         exit (1);
     }
     list_methods (c);
+    if (rng && scrub_rng_set (c, rng) < 0) {
+        fprintf (stderr, "scrub_rng_set: %s\n", scrub_strerror (c));
+        exit (1);
+    }
 
     for (i = optind; i < argc; i++) {
         scrub (c, argv[i]);
@@ -0,0 +1,235 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* AES-CTR keystream using the AES-NI and VAES instruction set extensions.
+ * The round keys come from the aes.c key schedule, and the counter is
+ * advanced exactly like genrand.c::incr128(), so these produce the same
+ * keystream as aes_encrypt() applied one block at a time.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include <assert.h>
+
+#include "util.h"
+#include "aes.h"
+#include "aesni.h"
+#include "hwrand.h"
+
+#if HAVE_AESNI
+#include <immintrin.h>
+#endif
+
+/* Convert the big-endian 32-bit words of an aes.c encryption key schedule
+ * into the byte-order round keys expected by AESENC.
+ */
+void
+aesni_set_key(aesni_context *ni, aes_context *ctx)
+{
+    int i;
+
+    ni->nr = ctx->nr;
+    for (i = 0; i < 4 * (ctx->nr + 1); i++) {
+        ni->rk[i / 4][(i % 4) * 4 + 0] = (uint8)(ctx->erk[i] >> 24);
+        ni->rk[i / 4][(i % 4) * 4 + 1] = (uint8)(ctx->erk[i] >> 16);
+        ni->rk[i / 4][(i % 4) * 4 + 2] = (uint8)(ctx->erk[i] >>  8);
+        ni->rk[i / 4][(i % 4) * 4 + 3] = (uint8)(ctx->erk[i]      );
+    }
+}
+
+#if HAVE_AESNI
+
+#define AESNI_LANES 8   /* blocks in flight per iteration */
+
+bool
+aesni_available(void)
+{
+    return (hwcaps() & HWCAP_AESNI) != 0;
+}
+
+/* Counter block 'n' blocks past the 128 bit counter 'lo','hi'.
+ */
+static inline __attribute__((target("sse2"))) __m128i
+ctr_block(unsigned long long lo, unsigned long long hi, unsigned long long n)
+{
+    unsigned long long l = lo + n;
+
+    return _mm_set_epi64x((long long)(hi + (l < lo)), (long long)l);
+}
+
+static inline void
+ctr_advance(uint8 ctr[16], unsigned long long n)
+{
+    unsigned long long t[2];
+
+    memcpy(t, ctr, sizeof(t));
+    t[0] += n;
+    if (t[0] < n)
+        t[1]++;
+    memcpy(ctr, t, sizeof(t));
+}
+
+__attribute__((target("aes,sse2"))) void
+aesni_encrypt(aesni_context *ni, uint8 input[16], uint8 output[16])
+{
+    __m128i x;
+    int r;
+
+    x = _mm_loadu_si128((__m128i *)input);
+    x = _mm_xor_si128(x, _mm_loadu_si128((__m128i *)ni->rk[0]));
+    for (r = 1; r < ni->nr; r++)
+        x = _mm_aesenc_si128(x, _mm_loadu_si128((__m128i *)ni->rk[r]));
+    x = _mm_aesenclast_si128(x, _mm_loadu_si128((__m128i *)ni->rk[r]));
+    _mm_storeu_si128((__m128i *)output, x);
+}
+
+__attribute__((target("aes,sse2"))) void
+aesni_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen)
+{
+    __m128i rk[15], b[AESNI_LANES];
+    unsigned long long t[2];
+    unsigned long long n = 0;
+    int i, r, nr = ni->nr;
+
+    for (r = 0; r <= nr; r++)
+        rk[r] = _mm_loadu_si128((__m128i *)ni->rk[r]);
+    memcpy(t, ctr, sizeof(t));
+
+    while (buflen >= AESNI_LANES * 16) {
+        for (i = 0; i < AESNI_LANES; i++)
+            b[i] = _mm_xor_si128(ctr_block(t[0], t[1], n + i), rk[0]);
+        for (r = 1; r < nr; r++)
+            for (i = 0; i < AESNI_LANES; i++)
+                b[i] = _mm_aesenc_si128(b[i], rk[r]);
+        for (i = 0; i < AESNI_LANES; i++) {
+            b[i] = _mm_aesenclast_si128(b[i], rk[nr]);
+            _mm_storeu_si128((__m128i *)buf + i, b[i]);
+        }
+        buf += AESNI_LANES * 16;
+        buflen -= AESNI_LANES * 16;
+        n += AESNI_LANES;
+    }
+    while (buflen > 0) {
+        b[0] = _mm_xor_si128(ctr_block(t[0], t[1], n), rk[0]);
+        for (r = 1; r < nr; r++)
+            b[0] = _mm_aesenc_si128(b[0], rk[r]);
+        b[0] = _mm_aesenclast_si128(b[0], rk[nr]);
+        if (buflen >= 16)
+            _mm_storeu_si128((__m128i *)buf, b[0]);
+        else {
+            uint8 out[16];
+
+            _mm_storeu_si128((__m128i *)out, b[0]);
+            memcpy(buf, out, buflen);
+        }
+        buf += 16;
+        buflen -= 16;
+        n++;
+    }
+    ctr_advance(ctr, n);
+}
+
+#else /* !HAVE_AESNI */
+
+bool
+aesni_available(void)
+{
+    return false;
+}
+
+void
+aesni_encrypt(aesni_context *ni, uint8 input[16], uint8 output[16])
+{
+    assert(0);
+}
+
+void
+aesni_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen)
+{
+    assert(0);
+}
+
+#endif /* HAVE_AESNI */
+
+#if HAVE_AESNI && HAVE_VAES
+
+#define VAES_VECS   4   /* 512-bit vectors (4 blocks each) per iteration */
+
+bool
+vaes_available(void)
+{
+    return (hwcaps() & (HWCAP_AESNI | HWCAP_VAES))
+                    == (HWCAP_AESNI | HWCAP_VAES);
+}
+
+static inline __attribute__((target("avx512f"))) __m512i
+ctr_block4(unsigned long long lo, unsigned long long hi, unsigned long long n)
+{
+    unsigned long long l0 = lo + n, l1 = l0 + 1, l2 = l0 + 2, l3 = l0 + 3;
+
+    return _mm512_set_epi64((long long)(hi + (l3 < lo)), (long long)l3,
+                            (long long)(hi + (l2 < lo)), (long long)l2,
+                            (long long)(hi + (l1 < lo)), (long long)l1,
+                            (long long)(hi + (l0 < lo)), (long long)l0);
+}
+
+__attribute__((target("aes,vaes,avx512f"))) void
+vaes_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen)
+{
+    __m512i rk[15], b[VAES_VECS];
+    unsigned long long t[2];
+    unsigned long long n = 0;
+    int i, r, nr = ni->nr;
+
+    for (r = 0; r <= nr; r++)
+        rk[r] = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i *)ni->rk[r]));
+    memcpy(t, ctr, sizeof(t));
+
+    while (buflen >= VAES_VECS * 64) {
+        for (i = 0; i < VAES_VECS; i++)
+            b[i] = _mm512_xor_si512(ctr_block4(t[0], t[1], n + 4 * i), rk[0]);
+        for (r = 1; r < nr; r++)
+            for (i = 0; i < VAES_VECS; i++)
+                b[i] = _mm512_aesenc_epi128(b[i], rk[r]);
+        for (i = 0; i < VAES_VECS; i++) {
+            b[i] = _mm512_aesenclast_epi128(b[i], rk[nr]);
+            _mm512_storeu_si512((__m512i *)buf + i, b[i]);
+        }
+        buf += VAES_VECS * 64;
+        buflen -= VAES_VECS * 64;
+        n += VAES_VECS * 4;
+    }
+    ctr_advance(ctr, n);
+    if (buflen > 0)
+        aesni_ctr(ni, ctr, buf, buflen);
+}
+
+#else /* !(HAVE_AESNI && HAVE_VAES) */
+
+bool
+vaes_available(void)
+{
+    return false;
+}
+
+void
+vaes_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen)
+{
+    assert(0);
+}
+
+#endif /* HAVE_AESNI && HAVE_VAES */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,36 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Requires aes.h and util.h (for bool) to be included first.
+ */
+
+typedef struct {
+    uint8 rk[15][16];   /* encryption round keys in byte order */
+    int nr;             /* number of rounds */
+} aesni_context;
+
+/* Generate 'buflen' bytes of AES-CTR keystream into 'buf' starting at
+ * counter block 'ctr', then advance 'ctr' past the blocks consumed.
+ * A partial final block consumes a whole counter value.
+ */
+typedef void (*aesctr_t)(aesni_context *ni, uint8 ctr[16],
+                         uint8 *buf, int buflen);
+
+bool aesni_available(void);
+bool vaes_available(void);
+void aesni_set_key(aesni_context *ni, aes_context *ctx);
+void aesni_encrypt(aesni_context *ni, uint8 input[16], uint8 output[16]);
+void aesni_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen);
+void vaes_ctr(aesni_context *ni, uint8 ctr[16], uint8 *buf, int buflen);
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
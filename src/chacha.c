@@ -0,0 +1,386 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* ChaCha20 keystream generator (D. J. Bernstein, "ChaCha, a variant of
+ * Salsa20", 2008) with a portable reference implementation and SSE2,
+ * AVX2 and NEON kernels that compute several blocks at once.  This is
+ * for CPUs with no AES acceleration, where it is much faster than aes.c.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+
+#include "util.h"
+#include "chacha.h"
+#include "hwrand.h"
+
+#if HAVE_SSE2 || HAVE_AVX2
+#include <immintrin.h>
+#endif
+#if (defined(__ARM_NEON) || defined(__aarch64__)) && !defined(__ARM_BIG_ENDIAN)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static const unsigned int sigma[4] = {
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574  /* "expand 32-byte k" */
+};
+
+#define GET_LE32(b)     ((unsigned int)(b)[0]         |                 \
+                         (unsigned int)(b)[1] <<  8   |                 \
+                         (unsigned int)(b)[2] << 16   |                 \
+                         (unsigned int)(b)[3] << 24)
+
+#define PUT_LE32(b,n)   do {                                            \
+                            (b)[0] = (unsigned char)((n)      );        \
+                            (b)[1] = (unsigned char)((n) >>  8);        \
+                            (b)[2] = (unsigned char)((n) >> 16);        \
+                            (b)[3] = (unsigned char)((n) >> 24);        \
+                        } while (0)
+
+void
+chacha_set_key(chacha_context *ctx, const unsigned char *key,
+               const unsigned char *nonce)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        ctx->key[i] = GET_LE32(&key[i * 4]);
+    for (i = 0; i < 2; i++)
+        ctx->nonce[i] = GET_LE32(&nonce[i * 4]);
+}
+
+/* Initial state for 'block'.
+ */
+static void
+chacha_state(chacha_context *ctx, unsigned long long block, unsigned int *s)
+{
+    memcpy(&s[0], sigma, sizeof(sigma));
+    memcpy(&s[4], ctx->key, sizeof(ctx->key));
+    s[12] = (unsigned int)block;
+    s[13] = (unsigned int)(block >> 32);
+    s[14] = ctx->nonce[0];
+    s[15] = ctx->nonce[1];
+}
+
+#define ROTL32(v,n)     (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QROUND(a,b,c,d) do {                                            \
+                            a += b; d ^= a; d = ROTL32(d, 16);          \
+                            c += d; b ^= c; b = ROTL32(b, 12);          \
+                            a += b; d ^= a; d = ROTL32(d,  8);          \
+                            c += d; b ^= c; b = ROTL32(b,  7);          \
+                        } while (0)
+
+void
+chacha_ref(chacha_context *ctx, unsigned long long block,
+           unsigned char *buf, int buflen)
+{
+    unsigned int s[16], x[16];
+    unsigned char out[CHACHA_BLOCK_SZ];
+    int i, len;
+
+    while (buflen > 0) {
+        chacha_state(ctx, block++, s);
+        memcpy(x, s, sizeof(x));
+        for (i = 0; i < 10; i++) {
+            QROUND(x[0], x[4], x[ 8], x[12]);
+            QROUND(x[1], x[5], x[ 9], x[13]);
+            QROUND(x[2], x[6], x[10], x[14]);
+            QROUND(x[3], x[7], x[11], x[15]);
+            QROUND(x[0], x[5], x[10], x[15]);
+            QROUND(x[1], x[6], x[11], x[12]);
+            QROUND(x[2], x[7], x[ 8], x[13]);
+            QROUND(x[3], x[4], x[ 9], x[14]);
+        }
+        len = buflen < CHACHA_BLOCK_SZ ? buflen : CHACHA_BLOCK_SZ;
+        if (len == CHACHA_BLOCK_SZ) {
+            for (i = 0; i < 16; i++)
+                PUT_LE32(&buf[i * 4], x[i] + s[i]);
+        } else {
+            for (i = 0; i < 16; i++)
+                PUT_LE32(&out[i * 4], x[i] + s[i]);
+            memcpy(buf, out, len);
+        }
+        buf += len;
+        buflen -= len;
+    }
+}
+
+/* The SIMD kernels hold word i of N consecutive blocks in vector x[i],
+ * run the double rounds on all N blocks at once, then transpose back
+ * to block order.  Leftover blocks go to the next narrower kernel.
+ */
+
+#if HAVE_SSE2
+#define SSE2_ROTL(v,n)  _mm_or_si128(_mm_slli_epi32(v, n),              \
+                                     _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_QROUND(a,b,c,d) do {                                       \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12); \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d,  8); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b,  7); \
+    } while (0)
+
+__attribute__((target("sse2"))) static void
+chacha_sse2(chacha_context *ctx, unsigned long long block,
+            unsigned char *buf, int buflen)
+{
+    unsigned int s[16];
+    __m128i x[16], o[16], t0, t1, t2, t3;
+    unsigned long long b[4];
+    int i, j, g;
+
+    while (buflen >= 4 * CHACHA_BLOCK_SZ) {
+        chacha_state(ctx, block, s);
+        for (i = 0; i < 4; i++)
+            b[i] = block + i;
+        for (i = 0; i < 12; i++)
+            o[i] = _mm_set1_epi32((int)s[i]);
+        o[12] = _mm_set_epi32((int)b[3], (int)b[2], (int)b[1], (int)b[0]);
+        o[13] = _mm_set_epi32((int)(b[3] >> 32), (int)(b[2] >> 32),
+                              (int)(b[1] >> 32), (int)(b[0] >> 32));
+        o[14] = _mm_set1_epi32((int)s[14]);
+        o[15] = _mm_set1_epi32((int)s[15]);
+        memcpy(x, o, sizeof(x));
+        for (i = 0; i < 10; i++) {
+            SSE2_QROUND(x[0], x[4], x[ 8], x[12]);
+            SSE2_QROUND(x[1], x[5], x[ 9], x[13]);
+            SSE2_QROUND(x[2], x[6], x[10], x[14]);
+            SSE2_QROUND(x[3], x[7], x[11], x[15]);
+            SSE2_QROUND(x[0], x[5], x[10], x[15]);
+            SSE2_QROUND(x[1], x[6], x[11], x[12]);
+            SSE2_QROUND(x[2], x[7], x[ 8], x[13]);
+            SSE2_QROUND(x[3], x[4], x[ 9], x[14]);
+        }
+        for (i = 0; i < 16; i++)
+            x[i] = _mm_add_epi32(x[i], o[i]);
+        /* 4x4 transpose of each group of four words */
+        for (g = 0; g < 4; g++) {
+            t0 = _mm_unpacklo_epi32(x[4 * g + 0], x[4 * g + 1]);
+            t1 = _mm_unpackhi_epi32(x[4 * g + 0], x[4 * g + 1]);
+            t2 = _mm_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            t3 = _mm_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            o[0] = _mm_unpacklo_epi64(t0, t2);
+            o[1] = _mm_unpackhi_epi64(t0, t2);
+            o[2] = _mm_unpacklo_epi64(t1, t3);
+            o[3] = _mm_unpackhi_epi64(t1, t3);
+            for (j = 0; j < 4; j++)
+                _mm_storeu_si128((__m128i *)(buf + j * CHACHA_BLOCK_SZ
+                                             + g * 16), o[j]);
+        }
+        block += 4;
+        buf += 4 * CHACHA_BLOCK_SZ;
+        buflen -= 4 * CHACHA_BLOCK_SZ;
+    }
+    if (buflen > 0)
+        chacha_ref(ctx, block, buf, buflen);
+}
+#endif /* HAVE_SSE2 */
+
+#if HAVE_AVX2 && HAVE_SSE2   /* the tail goes to chacha_sse2() */
+#define AVX2_ROTL(v,n)  _mm256_or_si256(_mm256_slli_epi32(v, n),        \
+                                        _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_QROUND(a,b,c,d) do {                                       \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);         \
+        d = _mm256_shuffle_epi8(d, rot16);                              \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);         \
+        b = AVX2_ROTL(b, 12);                                           \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);         \
+        d = _mm256_shuffle_epi8(d, rot8);                               \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);         \
+        b = AVX2_ROTL(b, 7);                                            \
+    } while (0)
+
+__attribute__((target("avx2"))) static void
+chacha_avx2(chacha_context *ctx, unsigned long long block,
+            unsigned char *buf, int buflen)
+{
+    unsigned int s[16];
+    __m256i x[16], o[16], t0, t1, t2, t3, u[4][4];
+    unsigned long long b[8];
+    const __m256i rot16 = _mm256_set_epi8(
+                            13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                            13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(
+                            14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                            14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    int i, k, g;
+
+    while (buflen >= 8 * CHACHA_BLOCK_SZ) {
+        chacha_state(ctx, block, s);
+        for (i = 0; i < 8; i++)
+            b[i] = block + i;
+        for (i = 0; i < 12; i++)
+            o[i] = _mm256_set1_epi32((int)s[i]);
+        o[12] = _mm256_set_epi32((int)b[7], (int)b[6], (int)b[5], (int)b[4],
+                                 (int)b[3], (int)b[2], (int)b[1], (int)b[0]);
+        o[13] = _mm256_set_epi32((int)(b[7] >> 32), (int)(b[6] >> 32),
+                                 (int)(b[5] >> 32), (int)(b[4] >> 32),
+                                 (int)(b[3] >> 32), (int)(b[2] >> 32),
+                                 (int)(b[1] >> 32), (int)(b[0] >> 32));
+        o[14] = _mm256_set1_epi32((int)s[14]);
+        o[15] = _mm256_set1_epi32((int)s[15]);
+        memcpy(x, o, sizeof(x));
+        for (i = 0; i < 10; i++) {
+            AVX2_QROUND(x[0], x[4], x[ 8], x[12]);
+            AVX2_QROUND(x[1], x[5], x[ 9], x[13]);
+            AVX2_QROUND(x[2], x[6], x[10], x[14]);
+            AVX2_QROUND(x[3], x[7], x[11], x[15]);
+            AVX2_QROUND(x[0], x[5], x[10], x[15]);
+            AVX2_QROUND(x[1], x[6], x[11], x[12]);
+            AVX2_QROUND(x[2], x[7], x[ 8], x[13]);
+            AVX2_QROUND(x[3], x[4], x[ 9], x[14]);
+        }
+        for (i = 0; i < 16; i++)
+            x[i] = _mm256_add_epi32(x[i], o[i]);
+        /* Transpose within 128-bit lanes: u[g][k] holds words 4g..4g+3
+         * of block k in the low lane and of block k+4 in the high lane.
+         */
+        for (g = 0; g < 4; g++) {
+            t0 = _mm256_unpacklo_epi32(x[4 * g + 0], x[4 * g + 1]);
+            t1 = _mm256_unpackhi_epi32(x[4 * g + 0], x[4 * g + 1]);
+            t2 = _mm256_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            t3 = _mm256_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            u[g][0] = _mm256_unpacklo_epi64(t0, t2);
+            u[g][1] = _mm256_unpackhi_epi64(t0, t2);
+            u[g][2] = _mm256_unpacklo_epi64(t1, t3);
+            u[g][3] = _mm256_unpackhi_epi64(t1, t3);
+        }
+        for (k = 0; k < 4; k++) {
+            unsigned char *lo = buf + k * CHACHA_BLOCK_SZ;
+            unsigned char *hi = buf + (k + 4) * CHACHA_BLOCK_SZ;
+
+            _mm256_storeu_si256((__m256i *)lo,
+                        _mm256_permute2x128_si256(u[0][k], u[1][k], 0x20));
+            _mm256_storeu_si256((__m256i *)(lo + 32),
+                        _mm256_permute2x128_si256(u[2][k], u[3][k], 0x20));
+            _mm256_storeu_si256((__m256i *)hi,
+                        _mm256_permute2x128_si256(u[0][k], u[1][k], 0x31));
+            _mm256_storeu_si256((__m256i *)(hi + 32),
+                        _mm256_permute2x128_si256(u[2][k], u[3][k], 0x31));
+        }
+        block += 8;
+        buf += 8 * CHACHA_BLOCK_SZ;
+        buflen -= 8 * CHACHA_BLOCK_SZ;
+    }
+    if (buflen > 0)
+        chacha_sse2(ctx, block, buf, buflen);
+}
+#endif /* HAVE_AVX2 && HAVE_SSE2 */
+
+#if HAVE_NEON
+#define NEON_ROTL(v,n)  vorrq_u32(vshlq_n_u32(v, n), vshrq_n_u32(v, 32 - (n)))
+#define NEON_QROUND(a,b,c,d) do {                                       \
+        a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d, 16); \
+        c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b, 12); \
+        a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d,  8); \
+        c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b,  7); \
+    } while (0)
+
+static void
+chacha_neon(chacha_context *ctx, unsigned long long block,
+            unsigned char *buf, int buflen)
+{
+    unsigned int s[16], lo[4], hi[4];
+    uint32x4_t x[16], o[16];
+    uint32x4x4_t q;
+    unsigned char tmp[4 * 16];
+    int i, k, g;
+
+    while (buflen >= 4 * CHACHA_BLOCK_SZ) {
+        chacha_state(ctx, block, s);
+        for (i = 0; i < 4; i++) {
+            lo[i] = (unsigned int)(block + i);
+            hi[i] = (unsigned int)((block + i) >> 32);
+        }
+        for (i = 0; i < 16; i++)
+            o[i] = vdupq_n_u32(s[i]);
+        o[12] = vld1q_u32(lo);
+        o[13] = vld1q_u32(hi);
+        memcpy(x, o, sizeof(x));
+        for (i = 0; i < 10; i++) {
+            NEON_QROUND(x[0], x[4], x[ 8], x[12]);
+            NEON_QROUND(x[1], x[5], x[ 9], x[13]);
+            NEON_QROUND(x[2], x[6], x[10], x[14]);
+            NEON_QROUND(x[3], x[7], x[11], x[15]);
+            NEON_QROUND(x[0], x[5], x[10], x[15]);
+            NEON_QROUND(x[1], x[6], x[11], x[12]);
+            NEON_QROUND(x[2], x[7], x[ 8], x[13]);
+            NEON_QROUND(x[3], x[4], x[ 9], x[14]);
+        }
+        for (i = 0; i < 16; i++)
+            x[i] = vaddq_u32(x[i], o[i]);
+        /* vst4q interleaves words 4g..4g+3 into block order */
+        for (g = 0; g < 4; g++) {
+            q.val[0] = x[4 * g + 0];
+            q.val[1] = x[4 * g + 1];
+            q.val[2] = x[4 * g + 2];
+            q.val[3] = x[4 * g + 3];
+            vst4q_u32((uint32_t *)tmp, q);
+            for (k = 0; k < 4; k++)
+                memcpy(buf + k * CHACHA_BLOCK_SZ + g * 16, &tmp[k * 16], 16);
+        }
+        block += 4;
+        buf += 4 * CHACHA_BLOCK_SZ;
+        buflen -= 4 * CHACHA_BLOCK_SZ;
+    }
+    if (buflen > 0)
+        chacha_ref(ctx, block, buf, buflen);
+}
+#endif /* HAVE_NEON */
+
+/* Look up a kernel by name, if this build and CPU can run it.
+ */
+chachafn_t
+chacha_lookup(const char *name)
+{
+    if (!strcmp(name, "ref"))
+        return chacha_ref;
+#if HAVE_AVX2 && HAVE_SSE2
+    if (!strcmp(name, "avx2") && (hwcaps() & HWCAP_AVX2))
+        return chacha_avx2;
+#endif
+#if HAVE_SSE2
+    if (!strcmp(name, "sse2") && (hwcaps() & HWCAP_SSE2))
+        return chacha_sse2;
+#endif
+#if HAVE_NEON
+    if (!strcmp(name, "neon"))
+        return chacha_neon;
+#endif
+    return NULL;
+}
+
+/* Return the fastest kernel this build and CPU can run.
+ */
+chachafn_t
+chacha_best(const char **namep)
+{
+    static const char *names[] = { "avx2", "sse2", "neon", "ref", NULL };
+    chachafn_t fn = NULL;
+    int i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        if ((fn = chacha_lookup(names[i]))) {
+            if (namep)
+                *namep = names[i];
+            break;
+        }
+    }
+    return fn;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
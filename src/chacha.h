@@ -0,0 +1,40 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Requires util.h (for bool) to be included first.
+ */
+
+#define CHACHA_KEY_SZ   32
+#define CHACHA_NONCE_SZ 8
+#define CHACHA_BLOCK_SZ 64
+
+typedef struct {
+    unsigned int key[8];
+    unsigned int nonce[2];
+} chacha_context;
+
+/* Generate 'buflen' bytes of ChaCha20 keystream into 'buf' starting at
+ * 64-byte block number 'block'.  The block counter is 64 bits and the
+ * nonce 64 bits, as in the original ChaCha.
+ */
+typedef void (*chachafn_t)(chacha_context *ctx, unsigned long long block,
+                           unsigned char *buf, int buflen);
+
+void chacha_set_key(chacha_context *ctx, const unsigned char *key,
+                    const unsigned char *nonce);
+void chacha_ref(chacha_context *ctx, unsigned long long block,
+                unsigned char *buf, int buflen);
+chachafn_t chacha_best(const char **namep);
+chachafn_t chacha_lookup(const char *name);
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
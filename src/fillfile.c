@@ -23,22 +23,92 @@
 #if HAVE_PTHREAD_H
 #include <pthread.h>
 #endif
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#if HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif
 #include <assert.h>
 
 #include "util.h"
+#include "pattern.h"
 #include "fillfile.h"
+#include "getsize.h"
+#include "uring.h"
 
 static int no_threads = 0;
+static int ring_threads = 0;    /* 0 means adapt, up to online CPUs */
+static int ring_depth = 0;      /* 0 means ring_threads + 2 */
+static bool fill_verbose = false;
+static bool fill_dsync = false;
 
-struct memstruct {
-    refill_t refill;
+typedef enum { IO_AUTO, IO_SYNC, IO_URING, IO_MMAP, IO_SPLICE } ioengine_t;
+
+static ioengine_t io_engine = IO_AUTO;
+static int io_depth = 0;        /* 0 means IO_DEPTH */
+
+#define IO_DEPTH        16      /* default io_uring queue depth */
+#define IO_READBUFS     4       /* cap on io_uring verify read buffers */
+
+static int fill_streams = 0;    /* 0 means pick by device type */
+
+#define FILL_STREAMS    4       /* default streams on SSD/NVMe block devices */
+
+#define ZERO_CHUNK      (256*1024*1024) /* bytes per BLKZEROOUT */
+
+#define WB_WINDOW       (32*1024*1024)  /* buffered writeback window */
+
+#define MMAP_WINDOW     (64*1024*1024)  /* bytes mapped at a time */
+
+#define RING_MAXTHREADS 8       /* cap on adaptive producer threads */
+#define RING_MINDEPTH   4
+#define RING_WINDOW     8       /* blocks between thread count decisions */
+
+typedef enum { SLOT_FREE, SLOT_FILLING, SLOT_FULL } slotstate_t;
+
+struct slot_struct {
     unsigned char *buf;
     int size;
+    off_t offset;       /* file offset the buffer will be written at */
+    slotstate_t state;
+    int err;            /* errno if refill failed, else 0 */
+};
+
+/* Ring of aligned buffers filled ahead of the writer by a pool of producer
+ * threads.  Block b (at offset b*memsize) always lands in slot b % depth,
+ * so the writer consumes blocks in order while producers may finish out
+ * of order.  The writer issues I/O straight from the slot buffer.
+ */
+struct ring_struct {
+    refill_t refill;
+    off_t filesize;
+    int memsize;
+    int depth;
+    struct slot_struct *slot;
+    off_t next_fill;    /* next block to be claimed by a producer */
+    off_t next_write;   /* next block to be handed to the writer */
+    int nthreads;
 #if WITH_PTHREADS
-    pthread_t thd;
-    int err;
+    pthread_t *thd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool shutdown;
+    int started;        /* producers started, for numbering them */
+    int active;         /* producers numbered below this may fill */
+    bool adaptive;      /* adjust 'active' to the writer's pace */
+    int win_blocks;     /* blocks handed to the writer this window */
+    int win_waits;      /* ... that the writer had to wait for */
+    int win_ahead;      /* ... with the rest of the ring already full */
 #endif
 };
+typedef struct ring_struct *ring_t;
 
 extern char *prog;
 
@@ -48,76 +118,162 @@ extern char *prog;
 # define MY_O_DIRECT 0
 #endif
 
-static void *
-refill_thread(void *arg)
+static off_t
+ring_nblocks(ring_t rp)
 {
-    struct memstruct *mp = (struct memstruct *)arg;
-
-    mp->refill(mp->buf, mp->size);
-    return mp;
+    return (rp->filesize + rp->memsize - 1) / rp->memsize;
 }
 
-static int
-refill_memcpy(struct memstruct *mp, unsigned char *mem, int memsize,
-              off_t filesize, off_t written)
+/* Assign block 'b' to its slot.
+ */
+static struct slot_struct *
+ring_claim(ring_t rp, off_t b)
 {
+    struct slot_struct *sp = &rp->slot[b % rp->depth];
+
+    sp->offset = b * rp->memsize;
+    sp->size = rp->memsize;
+    if (sp->size > rp->filesize - sp->offset)
+        sp->size = rp->filesize - sp->offset;
+    sp->state = SLOT_FILLING;
+    return sp;
+}
+
 #if WITH_PTHREADS
-    if (no_threads) {
-        mp->size = memsize;
-        refill_thread (mp);
-    } else {
-        if ((mp->err = pthread_join(mp->thd, NULL))) {
-            errno = mp->err;
-            goto error;
+static void *
+ring_producer(void *arg)
+{
+    ring_t rp = (ring_t)arg;
+    struct slot_struct *sp;
+    off_t nblocks = ring_nblocks(rp);
+    int id, err;
+
+    pthread_mutex_lock(&rp->lock);
+    id = rp->started++;
+    while (!rp->shutdown && rp->next_fill < nblocks) {
+        sp = &rp->slot[rp->next_fill % rp->depth];
+        if (sp->state != SLOT_FREE || id >= rp->active) {
+            pthread_cond_wait(&rp->cond, &rp->lock);
+            continue;
         }
-        assert (memsize == mp->size);
+        sp = ring_claim(rp, rp->next_fill++);
+        pthread_mutex_unlock(&rp->lock);
+
+        err = rp->refill(sp->buf, sp->size, sp->offset) < 0 ? errno : 0;
+
+        pthread_mutex_lock(&rp->lock);
+        sp->err = err;
+        sp->state = SLOT_FULL;
+        pthread_cond_broadcast(&rp->cond);
     }
-#else
-    mp->size = memsize;
-    refill_thread (mp);
+    pthread_mutex_unlock(&rp->lock);
+    return NULL;
+}
 #endif
-    memcpy(mem, mp->buf, memsize);
+
+static void
+ring_destroy(ring_t rp)
+{
+    int i;
+
 #if WITH_PTHREADS
-    if (!no_threads) {
-        written += memsize;
-        if (filesize - written > 0) {
-            if (mp->size > filesize - written)
-                mp->size = filesize - written;
-            if ((mp->err = pthread_create(&mp->thd, NULL, refill_thread, mp))) {
-                errno = mp->err;
-                goto error;
-            }
-        }
+    if (rp->thd) {
+        pthread_mutex_lock(&rp->lock);
+        rp->shutdown = true;
+        pthread_cond_broadcast(&rp->cond);
+        pthread_mutex_unlock(&rp->lock);
+        for (i = 0; i < rp->nthreads; i++)
+            (void)pthread_join(rp->thd[i], NULL);
+        free(rp->thd);
     }
+    pthread_mutex_destroy(&rp->lock);
+    pthread_cond_destroy(&rp->cond);
 #endif
-    return 0;
-error:
-    return -1;
+    for (i = 0; i < rp->depth; i++)
+        if (rp->slot[i].buf)
+            free(rp->slot[i].buf);
+    free(rp->slot);
+    free(rp);
+}
+
+/* Pick the number of producer threads.
+ */
+static int
+ring_nthreads(off_t nblocks)
+{
+    int n = ring_threads;
+
+    if (no_threads)
+        return 0;
+    if (n == 0) {   /* upper bound for the adaptive count */
+#ifdef _SC_NPROCESSORS_ONLN
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (n > RING_MAXTHREADS)
+            n = RING_MAXTHREADS;
+        if (n < 1)
+            n = 1;
+    }
+    if (n > nblocks)
+        n = nblocks;
+    return n;
 }
 
 static int
-refill_init(struct memstruct **mpp, refill_t refill, int memsize)
+ring_create(ring_t *rpp, refill_t refill, int memsize, off_t filesize)
 {
-    struct memstruct *mp = NULL;
+    ring_t rp;
+    int i, err;
 
-    if (!(mp = malloc(sizeof(struct memstruct))))
+    if (!(rp = malloc(sizeof(struct ring_struct))))
         goto nomem;
-    if (!(mp->buf = malloc(memsize))) {
-        free(mp);
+    memset(rp, 0, sizeof(struct ring_struct));
+    rp->refill = refill;
+    rp->memsize = memsize;
+    rp->filesize = filesize;
+#if WITH_PTHREADS
+    rp->nthreads = ring_nthreads(ring_nblocks(rp));
+    rp->adaptive = (ring_threads == 0 && rp->nthreads > 1);
+    rp->active = rp->adaptive ? 1 : rp->nthreads;
+    pthread_mutex_init(&rp->lock, NULL);
+    pthread_cond_init(&rp->cond, NULL);
+#endif
+    rp->depth = ring_depth;
+    if (rp->depth == 0) {
+        rp->depth = rp->nthreads + 2;
+        if (rp->depth < RING_MINDEPTH)
+            rp->depth = RING_MINDEPTH;
+    }
+    if (rp->depth > ring_nblocks(rp))
+        rp->depth = ring_nblocks(rp);
+    if (!(rp->slot = malloc(rp->depth * sizeof(struct slot_struct)))) {
+        free(rp);
         goto nomem;
     }
-    mp->size = memsize;
-    mp->refill = refill;
-    mp->thd = 0;
+    memset(rp->slot, 0, rp->depth * sizeof(struct slot_struct));
+    for (i = 0; i < rp->depth; i++) {
+        if (!(rp->slot[i].buf = alloc_buffer(memsize))) {
+            ring_destroy(rp);
+            goto nomem;
+        }
+    }
 #if WITH_PTHREADS
-    if (!no_threads) {
-        if ((mp->err = pthread_create(&mp->thd, NULL, refill_thread, mp))) {
-            errno = mp->err;
-            goto error;
+    if (rp->nthreads > 0) {
+        if (!(rp->thd = malloc(rp->nthreads * sizeof(pthread_t)))) {
+            ring_destroy(rp);
+            goto nomem;
+        }
+        for (i = 0; i < rp->nthreads; i++) {
+            if ((err = pthread_create(&rp->thd[i], NULL, ring_producer, rp))) {
+                rp->nthreads = i;
+                ring_destroy(rp);
+                errno = err;
+                goto error;
+            }
         }
     }
 #endif
-    *mpp = mp;
+    *rpp = rp;
     return 0;
 nomem:
     errno = ENOMEM;
@@ -125,77 +281,193 @@ error:
     return -1;
 }
 
+#if WITH_PTHREADS
+/* Adaptive thread count: each time the writer takes a block, note whether
+ * it had to wait for it (generators slower than the device) or whether
+ * the whole ring was already full (generators idle, waiting for the
+ * device).  Every RING_WINDOW blocks, start another producer if the writer
+ * waited more than once, or park one if the ring was always full.
+ * Caller holds rp->lock.
+ */
 static void
-refill_fini(struct memstruct *mp)
+ring_adapt(ring_t rp, bool waited)
+{
+    int i, full = 0, old = rp->active;
+    const char *why = NULL;
+
+    for (i = 0; i < rp->depth; i++)
+        if (rp->slot[i].state == SLOT_FULL)
+            full++;
+    rp->win_blocks++;
+    if (waited)
+        rp->win_waits++;
+    else if (full == rp->depth)
+        rp->win_ahead++;
+    if (rp->win_blocks < RING_WINDOW)
+        return;
+    if (rp->win_waits > 1 && rp->active < rp->nthreads) {
+        rp->active++;
+        why = "writer waited";
+        i = rp->win_waits;
+    } else if (rp->win_ahead == rp->win_blocks && rp->active > 1) {
+        rp->active--;
+        why = "ring full";
+        i = rp->win_ahead;
+    }
+    if (rp->active != old) {
+        if (fill_verbose)
+            fprintf(stderr, "%s: random data threads %d -> %d "
+                    "(%s for %d of %d blocks)\n", prog, old, rp->active,
+                    why, i, rp->win_blocks);
+        pthread_cond_broadcast(&rp->cond);
+    }
+    rp->win_blocks = rp->win_waits = rp->win_ahead = 0;
+}
+#endif
+
+/* Wait for the next block in file order and return its slot.
+ * Without producer threads, fill it here.  If the block could not be
+ * generated, return NULL with errno set.
+ */
+static struct slot_struct *
+ring_get(ring_t rp)
 {
+    struct slot_struct *sp = &rp->slot[rp->next_write++ % rp->depth];
+
+    if (rp->nthreads == 0) {
+        sp = ring_claim(rp, rp->next_fill++);
+        sp->err = rp->refill(sp->buf, sp->size, sp->offset) < 0 ? errno : 0;
+        sp->state = SLOT_FULL;
+    }
 #if WITH_PTHREADS
-    if (!no_threads)
-        (void)pthread_join(mp->thd, NULL);
+    else {
+        pthread_mutex_lock(&rp->lock);
+        if (rp->adaptive)
+            ring_adapt(rp, sp->state != SLOT_FULL);
+        while (sp->state != SLOT_FULL)
+            pthread_cond_wait(&rp->cond, &rp->lock);
+        pthread_mutex_unlock(&rp->lock);
+    }
 #endif
-    free (mp->buf);
-    free (mp);
+    if (sp->err) {
+        errno = sp->err;
+        return NULL;
+    }
+    return sp;
 }
 
-/* Fill file (can be regular or special file) with pattern in mem.
- * Writes will use memsize blocks.
- * If 'refill' is non-null, call it before each write (for random fill).
- * If 'progress' is non-null, call it after each write (for progress meter).
- * If 'sparse' is true, only scrub first and last blocks (for testing).
- * The number of bytes written is returned.
- * If 'creat' is true, open with O_CREAT and allow ENOSPC to be non-fatal.
+/* Hand a slot back to the producers once its data has been written.
+ * The writer may hold several slots, but returns them in file order.
  */
-off_t
-fillfile(char *path, off_t filesize, unsigned char *mem, int memsize,
-         progress_t progress, void *arg, refill_t refill,
-         bool sparse, bool creat)
+static void
+ring_put(ring_t rp, struct slot_struct *sp)
 {
-    int fd = -1;
-    off_t n;
-    off_t written = 0LL;
-    int openflags = O_WRONLY;
-    struct memstruct *mp = NULL;
+#if WITH_PTHREADS
+    pthread_mutex_lock(&rp->lock);
+#endif
+    sp->state = SLOT_FREE;
+#if WITH_PTHREADS
+    pthread_cond_broadcast(&rp->cond);
+    pthread_mutex_unlock(&rp->lock);
+#endif
+}
+
+/* Open 'path' for direct I/O if possible.
+ */
+static int
+open_direct(char *path, int openflags)
+{
+    int fd;
 
     if (filetype(path) != FILE_CHAR)
         openflags |= MY_O_DIRECT;
-    if (creat)
-        openflags |= O_CREAT;
     fd = open(path, openflags, 0644);
     if (fd < 0 && errno == EINVAL && openflags & MY_O_DIRECT) {
         /* Try again without (MY_)O_DIRECT */
         openflags &= ~MY_O_DIRECT;
         fd = open(path, openflags, 0644);
     }
-    if (fd < 0)
-        goto error;
-    do {
-        if (written + memsize > filesize)
-            memsize = filesize - written;
-        if (refill && !sparse) {
-            if (!mp)
-                if (refill_init(&mp, refill, memsize) < 0)
-                    goto error;
-            if (refill_memcpy(mp, mem, memsize, filesize, written) < 0)
-                goto error;
+    return fd;
+}
+
+/* Without O_DIRECT, written data piles up in the page cache until the
+ * final fsync(), which then stalls for as long as it takes to flush it.
+ * Instead, start writeback on each window of WB_WINDOW bytes as soon as
+ * it is complete, then wait for the window before it and drop it from
+ * the cache, so at most two windows are dirty or cached at a time.
+ * Write errors still surface at the final fsync().
+ */
+struct writeback_struct {
+    int fd;
+    off_t window;
+    off_t start;        /* first byte not yet handed to writeback */
+    off_t prev;         /* window being written back, or -1 */
+    bool on;
+};
+
+static void
+wb_init(struct writeback_struct *wb, int fd, off_t start, int memsize)
+{
+    wb->fd = fd;
+    wb->window = WB_WINDOW;
+    if (wb->window < memsize)
+        wb->window = memsize;
+    wb->start = start;
+    wb->prev = -1;
+    wb->on = false;
+#if defined(HAVE_SYNC_FILE_RANGE) && defined(SYNC_FILE_RANGE_WRITE)
+    wb->on = !(fcntl(fd, F_GETFL) & MY_O_DIRECT);
+#endif
+}
+
+/* Note that everything before 'done' has been written.
+ */
+static void
+wb_advance(struct writeback_struct *wb, off_t done)
+{
+#if defined(HAVE_SYNC_FILE_RANGE) && defined(SYNC_FILE_RANGE_WRITE)
+    while (wb->on && done - wb->start >= wb->window) {
+        if (sync_file_range(wb->fd, wb->start, wb->window,
+                            SYNC_FILE_RANGE_WRITE) < 0) {
+            wb->on = false; /* e.g. ESPIPE on a pipe or character device */
+            break;
         }
-        if (sparse && !(written == 0) && !(written + memsize == filesize)) {
-            if (lseek(fd, memsize, SEEK_CUR) < 0)
-                goto error;
-            written += memsize;
-        } else {
-            n = write_all(fd, mem, memsize);
-            if (creat && n < 0 && errno == ENOSPC)
-                break;
-            if (n == 0) {
-                errno = EINVAL; /* write past end of device? */
-                goto error;
-            } else if (n < 0)
-                goto error;
-            written += n;
+        if (wb->prev != -1) {
+            (void)sync_file_range(wb->fd, wb->prev, wb->window,
+                                  SYNC_FILE_RANGE_WAIT_BEFORE
+                                  | SYNC_FILE_RANGE_WRITE
+                                  | SYNC_FILE_RANGE_WAIT_AFTER);
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+            (void)posix_fadvise(wb->fd, wb->prev, wb->window,
+                                POSIX_FADV_DONTNEED);
+#endif
         }
-        if (progress)
-            progress(arg, (double)written/filesize);
-    } while (written < filesize);
-    if (fsync(fd) < 0) {
+        wb->prev = wb->start;
+        wb->start += wb->window;
+    }
+#endif
+}
+
+/* Write a block at the current file offset, or at 'offset' if it is not
+ * -1, durably if set_fill_dsync() was called.
+ */
+static int
+write_block(int fd, const unsigned char *buf, int count, off_t offset)
+{
+    if (fill_dsync)
+        return pwrite_dsync(fd, buf, count, offset);
+    if (offset == -1)
+        return write_all(fd, buf, count);
+    return pwrite_all(fd, buf, count, offset);
+}
+
+/* Flush a filled file to the device and close it.  If every write was
+ * already durable ('synced'), skip the flush.
+ */
+static int
+sync_close(int fd, off_t filesize, bool synced)
+{
+    if (!synced && fsync(fd) < 0) {
         if (errno != EINVAL)
             goto error;
         errno = 0;
@@ -204,86 +476,2257 @@ fillfile(char *path, off_t filesize, unsigned char *mem, int memsize,
     /* Try to fool the kernel into dropping any device cache */
     (void)posix_fadvise(fd, 0, filesize, POSIX_FADV_DONTNEED);
 #endif
-    if (close(fd) < 0)
+    return close(fd);
+error:
+    (void)close(fd);
+    return -1;
+}
+
+/* O_DIRECT transfers must be aligned to the device's logical block size,
+ * which a -s size or an ENOSPC-truncated file need not be.  Return the
+ * length of the part of a 'filesize' byte file on 'fd' that can be done
+ * with direct I/O.  The rest (less than one block) goes through
+ * tail_io().  For regular files the file system block size is used,
+ * which is a safe upper bound.
+ */
+static off_t
+direct_body(int fd, char *path, off_t filesize)
+{
+    struct stat sb;
+    topology_t t;
+    int align = 0;
+
+    if (!(fcntl(fd, F_GETFL) & MY_O_DIRECT))
+        return filesize;
+    if (gettopology(path, &t) == 0)
+        align = t.logical;
+    else if (fstat(fd, &sb) == 0)
+        align = sb.st_blksize;
+    if (align <= 0)
+        align = 512;
+    return filesize - filesize % align;
+}
+
+/* Write or read 'len' bytes at 'offset' of 'path' through a buffered
+ * descriptor, for the unaligned tail of an O_DIRECT pass.  Written data
+ * is flushed (unless set_fill_dsync() was called) and then dropped from
+ * the page cache.  Returns bytes transferred or -1 on error.
+ */
+static int
+tail_io(char *path, bool write, unsigned char *buf, int len, off_t offset)
+{
+    int fd, n;
+
+    if ((fd = open(path, write ? O_WRONLY : O_RDONLY)) < 0)
+        return -1;
+    if (write)
+        n = write_block(fd, buf, len, offset);
+    else if (lseek(fd, offset, SEEK_SET) < 0)
+        n = -1;
+    else
+        n = read_all(fd, buf, len);
+    if (n == 0)
+        errno = EINVAL; /* past end of device, or early EOF */
+    if (n <= 0) {
+        (void)close(fd);
+        return -1;
+    }
+    if (!write) {
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+        (void)posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+        return close(fd) < 0 ? -1 : len;
+    }
+    return sync_close(fd, offset + len, fill_dsync) < 0 ? -1 : len;
+}
+
+/* A read or write in flight on the io_uring engine.  Requests are
+ * numbered in file order and completions may arrive in any order, so
+ * progress only advances over the completed prefix.
+ */
+struct ureq_struct {
+    off_t offset;       /* next byte to transfer */
+    off_t end;
+    unsigned char *base;
+    unsigned char *buf; /* buffer address for 'offset' */
+    int bufidx;         /* registered buffer index */
+    struct slot_struct *sp;
+    bool done;
+};
+
+/* Return true if 'fd' can take I/O at explicit offsets, in any order:
+ * regular files and block devices.  Character devices may be streams
+ * that only honour the file position.
+ */
+static bool
+positional(int fd)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0)
+        return false;
+    return S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode);
+}
+
+/* Set up io_uring for 'fd' unless disabled or unavailable.
+ */
+static bool
+io_uring_setup(uring_t *up, int fd)
+{
+    static bool warned = false;
+
+    if (io_engine == IO_SYNC || io_engine == IO_MMAP
+                             || io_engine == IO_SPLICE)
+        return false;
+    if (!positional(fd))
+        return false;
+    if (uring_create(up, fd, io_depth ? io_depth : IO_DEPTH) == 0)
+        return true;
+    if (fill_verbose && !warned) {
+        fprintf(stderr, "%s: io_uring: %s, using synchronous I/O\n", prog,
+                strerror(errno));
+        warned = true;
+    }
+    return false;
+}
+
+/* Wait out any requests still in flight after an error.
+ */
+static void
+uring_drain(uring_t up, int inflight)
+{
+    unsigned long long tag;
+    int res;
+
+    while (inflight-- > 0)
+        if (uring_reap(up, &tag, &res) < 0)
+            break;
+}
+
+/* Note a failed request, keeping the error nearest the start of the file.
+ */
+static void
+ureq_error(struct ureq_struct *q, int res, int *errp, off_t *erroffp)
+{
+    if (*errp == 0 || q->offset < *erroffp) {
+        *errp = res < 0 ? -res : EINVAL;    /* 0: past end of device? */
+        *erroffp = q->offset;
+    }
+}
+
+/* The io_uring version of the fillfile() write loop.  Up to the queue
+ * depth of writes are kept in flight from mem, or from as many ring slots
+ * as are filled.  On ENOSPC with 'creat', anything written beyond the
+ * completed prefix is truncated so the result matches the synchronous
+ * loop.
+ */
+static off_t
+fill_uring(uring_t up, int fd, off_t filesize, unsigned char *mem,
+           int memsize, progress_t progress, void *arg, refill_t refill,
+           bool creat)
+{
+    struct ureq_struct *req = NULL, *q;
+    ring_t rp = NULL;
+    struct slot_struct *sp;
+    unsigned char **bufs;
+    unsigned long long tag, queued = 0, done = 0;
+    off_t next = 0, written = 0, erroff = 0;
+    int i, res, err = 0, inflight = 0;
+    int cap = io_depth ? io_depth : IO_DEPTH;
+    struct writeback_struct wb;
+
+    if (memsize > filesize)
+        memsize = filesize;
+    wb_init(&wb, fd, 0, memsize);
+    if (fill_dsync && uring_set_dsync(up) < 0)
+        goto error;
+    if (refill) {
+        if (ring_create(&rp, refill, memsize, filesize) < 0)
+            goto error;
+        if (cap > rp->depth - 1)    /* leave producers a slot */
+            cap = rp->depth - 1;
+        if (cap < 1)
+            cap = 1;
+        if ((bufs = malloc(rp->depth * sizeof(unsigned char *)))) {
+            for (i = 0; i < rp->depth; i++)
+                bufs[i] = rp->slot[i].buf;
+            (void)uring_register_buffers(up, bufs, rp->depth, memsize);
+            free(bufs);
+        }
+    } else
+        (void)uring_register_buffers(up, &mem, 1, memsize);
+    if (!(req = calloc(cap, sizeof(struct ureq_struct)))) {
+        errno = ENOMEM;
+        goto error;
+    }
+    while (written < filesize) {
+        while (!err && next < filesize && (int)(queued - done) < cap) {
+            q = &req[queued % cap];
+            q->offset = next;
+            q->end = next + memsize;
+            if (q->end > filesize)
+                q->end = filesize;
+            q->done = false;
+            if (rp) {
+                if (!(sp = ring_get(rp)))
+                    goto error;
+                assert(sp->offset == next && sp->size == q->end - next);
+                q->sp = sp;
+                q->base = sp->buf;
+                q->bufidx = sp - rp->slot;
+            } else {
+                q->sp = NULL;
+                q->base = mem;
+                q->bufidx = 0;
+            }
+            q->buf = q->base;
+            if (uring_queue(up, true, q->buf, q->bufidx, q->end - q->offset,
+                            q->offset, queued) < 0)
+                goto error;
+            queued++;
+            inflight++;
+            next = q->end;
+        }
+        if (inflight == 0)
+            break;
+        if (uring_reap(up, &tag, &res) < 0)
+            goto error;
+        inflight--;
+        q = &req[tag % cap];
+        if (res <= 0)
+            ureq_error(q, res, &err, &erroff);
+        else if (q->offset + res < q->end) {
+            q->offset += res;       /* short write: queue the rest */
+            q->buf += res;
+            if (uring_queue(up, true, q->buf, q->bufidx, q->end - q->offset,
+                            q->offset, tag) < 0)
+                goto error;
+            inflight++;
+        } else
+            q->done = true;
+        while (done < queued && req[done % cap].done) {
+            q = &req[done++ % cap];
+            q->done = false;
+            written = q->end;
+            if (q->sp)
+                ring_put(rp, q->sp);
+            wb_advance(&wb, written);
+            if (progress)
+                progress(arg, (double)written/filesize);
+        }
+    }
+    if (err == ENOSPC && creat) {
+        /* Everything is reaped, so the first request not done is one
+         * that failed; keep what a short write put down before that.
+         */
+        if (done < queued)
+            written = req[done % cap].offset;
+        if (ftruncate(fd, written) < 0)
+            goto error;
+    } else if (err) {
+        errno = err;
         goto error;
-    if (mp)
-        refill_fini(mp);
+    }
+    if (rp)
+        ring_destroy(rp);
+    free(req);
     return written;
 error:
-    if (mp)
-        refill_fini(mp);
-    if (fd != -1)
-        (void)close(fd);
+    uring_drain(up, inflight);
+    if (rp)
+        ring_destroy(rp);
+    if (req)
+        free(req);
     return (off_t)-1;
 }
 
-/* Verify that file was filled with 'mem' patterns.
+/* Compare 'len' bytes read at file offset 'offset' with what was
+ * written there: pattern 'pat' if non-null (blocks of 'blksize' bytes
+ * each start the pattern over), else the bytes at 'expect'.  Return the
+ * number of bytes that differ and put the index of the first in
+ * '*firstp'.
  */
-off_t
-checkfile(char *path, off_t filesize, unsigned char *mem, int memsize,
-          progress_t progress, void *arg, bool sparse)
+static size_t
+check_block(const unsigned char *buf, int len, off_t offset, int blksize,
+            const pattern_t *pat, const unsigned char *expect,
+            size_t *firstp)
 {
-    int fd = -1;
-    off_t n;
-    off_t verified = 0LL;
-    unsigned char *buf = NULL;
-    int openflags = O_RDONLY;
+    size_t bad = 0;
+    int i;
 
-    if (!(buf = alloc_buffer(memsize)))
-        goto nomem;
-    if (filetype(path) != FILE_CHAR)
-        openflags |= MY_O_DIRECT;
-    fd = open(path, openflags);
-    if (fd < 0 && errno == EINVAL && openflags & MY_O_DIRECT) {
-        /* Try again without (MY_)O_DIRECT */
-        openflags &= ~MY_O_DIRECT;
-        fd = open(path, openflags);
+    if (pat)
+        return memcmp_pat(buf, *pat, offset % blksize, len, firstp);
+    if (memcmp(expect, buf, len) == 0)
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (buf[i] != expect[i] && bad++ == 0)
+            *firstp = i;
     }
-    if (fd < 0)
+    return bad;
+}
+
+/* The io_uring version of the checkfile() read loop.  Up to IO_READBUFS
+ * reads are kept in flight, and each block is compared in file order as
+ * soon as it and all blocks before it have arrived.
+ */
+static off_t
+check_uring(uring_t up, off_t filesize, unsigned char *mem, int memsize,
+            progress_t progress, void *arg, refill_t refill,
+            const pattern_t *pat, size_t *mismatchp)
+{
+    struct ureq_struct *req = NULL, *q;
+    ring_t rp = NULL;
+    struct slot_struct *sp;
+    unsigned char **bufs = NULL;
+    unsigned long long tag, queued = 0, done = 0;
+    off_t next = 0, verified = 0, erroff = 0;
+    int i, res, err = 0, inflight = 0;
+    bool mismatch = false;
+    size_t bad, first = 0;
+    int cap = io_depth ? io_depth : IO_DEPTH;
+
+    if (cap > IO_READBUFS)
+        cap = IO_READBUFS;
+    if (memsize > filesize)
+        memsize = filesize;
+    if (!(req = calloc(cap, sizeof(struct ureq_struct))))
+        goto nomem;
+    if (!(bufs = calloc(cap, sizeof(unsigned char *))))
+        goto nomem;
+    for (i = 0; i < cap; i++)
+        if (!(bufs[i] = alloc_buffer(memsize)))
+            goto nomem;
+    (void)uring_register_buffers(up, bufs, cap, memsize);
+    if (refill && ring_create(&rp, refill, memsize, filesize) < 0)
         goto error;
-    do {
-        if (verified + memsize > filesize)
-            memsize = filesize - verified;
-        if (sparse && !(verified == 0) && !(verified + memsize == filesize)) {
-            if (lseek(fd, memsize, SEEK_CUR) < 0)
+    while (verified < filesize) {
+        while (!err && !mismatch && next < filesize
+               && (int)(queued - done) < cap) {
+            q = &req[queued % cap];
+            q->offset = next;
+            q->end = next + memsize;
+            if (q->end > filesize)
+                q->end = filesize;
+            q->done = false;
+            q->bufidx = queued % cap;
+            q->base = q->buf = bufs[q->bufidx];
+            if (uring_queue(up, false, q->buf, q->bufidx, q->end - q->offset,
+                            q->offset, queued) < 0)
                 goto error;
-            verified += memsize;
-        } else {
-            n = read_all(fd, buf, memsize);
-            if (n < 0)
-                goto error;
-            if (n == 0) {
-                errno = EINVAL; /* early EOF */
+            queued++;
+            inflight++;
+            next = q->end;
+        }
+        if (inflight == 0)
+            break;
+        if (uring_reap(up, &tag, &res) < 0)
+            goto error;
+        inflight--;
+        q = &req[tag % cap];
+        if (res <= 0)
+            ureq_error(q, res, &err, &erroff);  /* 0: early EOF */
+        else if (q->offset + res < q->end) {
+            q->offset += res;       /* short read: queue the rest */
+            q->buf += res;
+            if (uring_queue(up, false, q->buf, q->bufidx,
+                            q->end - q->offset, q->offset, tag) < 0)
                 goto error;
+            inflight++;
+        } else
+            q->done = true;
+        while (!mismatch && done < queued && req[done % cap].done) {
+            q = &req[done++ % cap];
+            q->done = false;
+            sp = NULL;
+            if (rp) {
+                if (!(sp = ring_get(rp)))
+                    goto error;
+                assert(sp->offset == verified);
             }
-            if (memcmp(mem, buf, memsize) != 0) {
-                break; /* return < filesize means verification failure */
-            }
-            verified += n;
+            bad = check_block(q->base, q->end - verified, verified, memsize,
+                              pat, sp ? sp->buf : mem, &first);
+            if (bad > 0) {
+                mismatch = true; /* return < filesize means failure */
+                verified += first;
+                *mismatchp = bad;
+            } else
+                verified = q->end;
+            if (sp)
+                ring_put(rp, sp);
+            if (progress && !mismatch)
+                progress(arg, (double)verified/filesize);
         }
-        if (progress)
-            progress(arg, (double)verified/filesize);
-    } while (verified < filesize);
-    if (close(fd) < 0)
+    }
+    if (err && !mismatch) {
+        errno = err;
         goto error;
-    free(buf);
+    }
+    if (rp)
+        ring_destroy(rp);
+    for (i = 0; i < cap; i++)
+        free(bufs[i]);
+    free(bufs);
+    free(req);
     return verified;
 nomem:
     errno = ENOMEM;
 error:
-    if (buf)
-        free (buf);
-    if (fd != -1)
-        (void)close(fd);
+    uring_drain(up, inflight);
+    if (rp)
+        ring_destroy(rp);
+    if (bufs) {
+        for (i = 0; i < cap; i++)
+            if (bufs[i])
+                free(bufs[i]);
+        free(bufs);
+    }
+    if (req)
+        free(req);
     return (off_t)-1;
 }
 
-void
+#if HAVE_SYS_MMAN_H
+/* Return true if the mmap engine should be used for 'path'.  It only
+ * handles regular files, and windows must start on page boundaries.
+ */
+static bool
+use_mmap(char *path, int memsize)
+{
+    return io_engine == IO_MMAP && filetype(path) == FILE_REGULAR
+        && memsize % getpagesize() == 0;
+}
+
+/* Return the size of the mmap window: MMAP_WINDOW, in whole blocks so
+ * patterns line up as they do when written a block at a time.
+ */
+static off_t
+mmap_window(off_t filesize, off_t offset, int memsize)
+{
+    off_t win = memsize;
+
+    if (MMAP_WINDOW > memsize)
+        win = MMAP_WINDOW - MMAP_WINDOW % memsize;
+    if (win > filesize - offset)
+        win = filesize - offset;
+    return win;
+}
+
+/* Copy-on-write file systems, where storing to a mapped page can need a
+ * new block at fault time even if the range was allocated beforehand.
+ */
+#define BTRFS_MAGIC     0x9123683e
+#define BCACHEFS_MAGIC  0xca451a4e
+#define ZFS_MAGIC       0x2fc12fc1
+
+/* Allocate the blocks under ['offset', 'offset' + 'len') of 'fd', so
+ * that filling them through a shared mapping cannot fail at fault time,
+ * where the only report is SIGBUS.  Return 0, or -1 if that cannot be
+ * promised: the file system copies on write, can't preallocate, or is
+ * out of space.
+ */
+static int
+mmap_reserve(int fd, off_t offset, off_t len)
+{
+#if HAVE_FALLOCATE
+#if HAVE_SYS_VFS_H
+    struct statfs sf;
+
+    if (fstatfs(fd, &sf) < 0)
+        return -1;
+    switch ((unsigned int)sf.f_type) {
+        case BTRFS_MAGIC:
+        case BCACHEFS_MAGIC:
+        case ZFS_MAGIC:
+            errno = EOPNOTSUPP;
+            return -1;
+    }
+#endif
+#ifdef FALLOC_FL_UNSHARE_RANGE
+    /* give reflinked blocks (XFS) a private copy to overwrite */
+    if (fallocate(fd, FALLOC_FL_UNSHARE_RANGE, offset, len) < 0
+            && errno != EOPNOTSUPP && errno != EINVAL)
+        return -1;
+#endif
+    return fallocate(fd, 0, offset, len);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* The mmap version of the fillfile() loop: map each window of the file,
+ * have 'refill' generate random data straight into it (or copy from
+ * mem), then msync() it and drop it from memory and the page cache.
+ * Each window is allocated with mmap_reserve() before it is mapped.  If
+ * that fails for the first window, the file size is put back, 0 is
+ * returned and the caller should write the whole pass with write()
+ * instead; a later failure (such as ENOSPC) fails the pass.
+ */
+static off_t
+fill_mmap(char *path, off_t filesize, unsigned char *mem, int memsize,
+          progress_t progress, void *arg, refill_t refill)
+{
+    static bool warned = false;
+    struct stat sb;
+    unsigned char *p = NULL;
+    off_t win = 0, offset, written = 0LL;
+    int fd, len;
+
+    if ((fd = open(path, O_RDWR)) < 0)
+        return (off_t)-1;
+    if (fstat(fd, &sb) < 0)
+        goto error;
+    /* extend the file to a padded size as write() would */
+    if (sb.st_size < filesize && ftruncate(fd, filesize) < 0)
+        goto error;
+    while (written < filesize) {
+        win = mmap_window(filesize, written, memsize);
+        if (mmap_reserve(fd, written, win) < 0) {
+            if (written > 0)    /* e.g. ENOSPC partway: fail the pass */
+                goto error;
+            if (fill_verbose && !warned) {
+                fprintf(stderr, "%s: mmap: %s, using write()\n", prog,
+                        strerror(errno));
+                warned = true;
+            }
+            if (sb.st_size < filesize)
+                (void)ftruncate(fd, sb.st_size);
+            (void)close(fd);
+            return 0;
+        }
+        p = mmap(NULL, win, PROT_READ | PROT_WRITE, MAP_SHARED, fd, written);
+        if (p == MAP_FAILED) {
+            p = NULL;
+            goto error;
+        }
+        for (offset = 0; offset < win; offset += len) {
+            len = memsize;
+            if (len > win - offset)
+                len = win - offset;
+            if (!refill)
+                memcpy(p + offset, mem, len);
+            else if (refill(p + offset, len, written + offset) < 0)
+                goto error;
+            if (progress)
+                progress(arg, (double)(written + offset + len)/filesize);
+        }
+        if (msync(p, win, MS_SYNC) < 0)
+            goto error;
+        (void)madvise(p, win, MADV_DONTNEED);
+        (void)munmap(p, win);
+        p = NULL;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+        (void)posix_fadvise(fd, written, win, POSIX_FADV_DONTNEED);
+#endif
+        written += win;
+    }
+    if (close(fd) < 0)
+        return (off_t)-1;
+    return written;
+error:
+    if (p)
+        (void)munmap(p, win);
+    (void)close(fd);
+    return (off_t)-1;
+}
+
+/* The mmap version of the checkfile() loop: compare each window of the
+ * file in place, with random data regenerated into mem.
+ */
+static off_t
+check_mmap(char *path, off_t filesize, unsigned char *mem, int memsize,
+           progress_t progress, void *arg, refill_t refill,
+           const pattern_t *pat, size_t *mismatchp)
+{
+    struct stat sb;
+    unsigned char *p = NULL;
+    off_t win = 0, offset, verified = 0LL;
+    int fd, len;
+    bool mismatch = false;
+    size_t bad, first = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (off_t)-1;
+    if (fstat(fd, &sb) < 0)
+        goto error;
+    if (sb.st_size < filesize) {
+        errno = EINVAL; /* early EOF */
+        goto error;
+    }
+    while (!mismatch && verified < filesize) {
+        win = mmap_window(filesize, verified, memsize);
+        p = mmap(NULL, win, PROT_READ, MAP_SHARED, fd, verified);
+        if (p == MAP_FAILED) {
+            p = NULL;
+            goto error;
+        }
+        (void)madvise(p, win, MADV_SEQUENTIAL);
+        for (offset = 0; offset < win; offset += len) {
+            len = memsize;
+            if (len > win - offset)
+                len = win - offset;
+            if (refill && refill(mem, len, verified + offset) < 0)
+                goto error;
+            bad = check_block(p + offset, len, verified + offset, memsize,
+                              pat, mem, &first);
+            if (bad > 0) {
+                mismatch = true; /* return < filesize means failure */
+                *mismatchp = bad;
+                break;
+            }
+            if (progress)
+                progress(arg, (double)(verified + offset + len)/filesize);
+        }
+        (void)munmap(p, win);
+        p = NULL;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+        (void)posix_fadvise(fd, verified, win, POSIX_FADV_DONTNEED);
+#endif
+        verified += offset;
+    }
+    if (close(fd) < 0)
+        return (off_t)-1;
+    return mismatch ? verified + (off_t)first : verified;
+error:
+    if (p)
+        (void)munmap(p, win);
+    (void)close(fd);
+    return (off_t)-1;
+}
+#else
+static bool
+use_mmap(char *path, int memsize)
+{
+    return false;
+}
+
+static off_t
+fill_mmap(char *path, off_t filesize, unsigned char *mem, int memsize,
+          progress_t progress, void *arg, refill_t refill)
+{
+    errno = ENOSYS;
+    return (off_t)-1;
+}
+
+static off_t
+check_mmap(char *path, off_t filesize, unsigned char *mem, int memsize,
+           progress_t progress, void *arg, refill_t refill,
+           const pattern_t *pat, size_t *mismatchp)
+{
+    errno = ENOSYS;
+    return (off_t)-1;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Return true if fixed patterns should be spliced to 'path'.
+ */
+static bool
+use_splice(char *path)
+{
+    return io_engine == IO_SPLICE && filetype(path) == FILE_CHAR;
+}
+
+#if HAVE_VMSPLICE && defined(SPLICE_F_MORE)
+/* Write the fixed pattern in mem to character device 'fd' without
+ * copying it into the kernel for every block: vmsplice() puts references
+ * to the pages of mem in a pipe, and splice() moves them to the device.
+ * The pages are not gifted, since the same ones serve every block; mem is
+ * not changed until the pass is over.  The number of bytes written is
+ * returned.  If the device doesn't take splice writes, 0 is returned
+ * with nothing written, and the caller should write() instead.
+ */
+static off_t
+fill_splice(int fd, off_t filesize, unsigned char *mem, int memsize,
+            progress_t progress, void *arg)
+{
+    static bool warned = false;
+    struct iovec iov;
+    off_t written = 0LL;
+    int pfd[2];
+    int pipesize = 0;
+    int len, n, saved;
+
+    if (pipe(pfd) < 0)
+        return (off_t)-1;
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    (void)fcntl(pfd[1], F_SETPIPE_SZ, memsize);
+    pipesize = fcntl(pfd[1], F_GETPIPE_SZ);
+#endif
+    if (pipesize <= 0)
+        pipesize = 65536;
+    while (written < filesize) {
+        len = memsize - written % memsize;
+        if (len > pipesize)
+            len = pipesize;
+        if (len > filesize - written)
+            len = filesize - written;
+        iov.iov_base = mem + written % memsize;
+        iov.iov_len = len;
+        if ((len = vmsplice(pfd[1], &iov, 1, 0)) < 0)
+            goto error;
+        while (len > 0) {
+            n = splice(pfd[0], NULL, fd, NULL, len, SPLICE_F_MORE);
+            if (n == 0) {
+                errno = EINVAL; /* write past end of device? */
+                goto error;
+            } else if (n < 0)
+                goto error;
+            len -= n;
+            written += n;
+        }
+        if (progress)
+            progress(arg, (double)written/filesize);
+    }
+    (void)close(pfd[0]);
+    (void)close(pfd[1]);
+    return written;
+error:
+    saved = errno;
+    (void)close(pfd[0]);
+    (void)close(pfd[1]);
+    errno = saved;
+    if (written == 0 && (errno == EINVAL || errno == ENOSYS)) {
+        if (fill_verbose && !warned) {
+            fprintf(stderr, "%s: splice: %s, using write()\n", prog,
+                    strerror(errno));
+            warned = true;
+        }
+        return 0;
+    }
+    return (off_t)-1;
+}
+#else
+static off_t
+fill_splice(int fd, off_t filesize, unsigned char *mem, int memsize,
+            progress_t progress, void *arg)
+{
+    return 0;
+}
+#endif /* HAVE_VMSPLICE */
+
+#if WITH_PTHREADS
+/* Multi-stream fill: the file is cut into contiguous regions of whole
+ * blocks, each written by its own thread with pwrite(), generating its
+ * own random data.  The caller's progress meter is driven from the
+ * shared byte count.
+ */
+struct fillstreams_struct {
+    int fd;
+    unsigned char *mem;
+    int memsize;
+    refill_t refill;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t written;      /* bytes written by all streams */
+    int running;
+    int err;            /* first error seen by any stream */
+};
+
+struct stream_struct {
+    struct fillstreams_struct *fs;
+    pthread_t thd;
+    off_t start, end;
+};
+
+static void *
+stream_writer(void *arg)
+{
+    struct stream_struct *st = (struct stream_struct *)arg;
+    struct fillstreams_struct *fs = st->fs;
+    unsigned char *buf = fs->mem;
+    off_t offset = st->start;
+    int n, len, err = 0;
+    struct writeback_struct wb;
+
+    wb_init(&wb, fs->fd, st->start, fs->memsize);
+    if (fs->refill && !(buf = alloc_buffer(fs->memsize)))
+        err = ENOMEM;
+    while (!err && offset < st->end) {
+        len = fs->memsize;
+        if (len > st->end - offset)
+            len = st->end - offset;
+        if (fs->refill && fs->refill(buf, len, offset) < 0)
+            n = -1;
+        else
+            n = write_block(fs->fd, buf, len, offset);
+        if (n == 0)
+            err = EINVAL;   /* write past end of device? */
+        else if (n < 0)
+            err = errno;
+        else {
+            offset += len;
+            wb_advance(&wb, offset);
+        }
+        pthread_mutex_lock(&fs->lock);
+        if (!err) {
+            fs->written += len;
+            pthread_cond_signal(&fs->cond);
+        }
+        if (fs->err)
+            err = fs->err;
+        pthread_mutex_unlock(&fs->lock);
+    }
+    pthread_mutex_lock(&fs->lock);
+    if (err && !fs->err)
+        fs->err = err;
+    fs->running--;
+    pthread_cond_signal(&fs->cond);
+    pthread_mutex_unlock(&fs->lock);
+    if (fs->refill && buf)
+        free(buf);
+    return NULL;
+}
+
+/* Write 'fd' with 'nstreams' threads, each covering one region.
+ * Returning (after all streams finish) is the barrier between passes.
+ */
+static off_t
+fill_streamed(int fd, off_t filesize, unsigned char *mem, int memsize,
+              progress_t progress, void *arg, refill_t refill, int nstreams)
+{
+    struct fillstreams_struct fs;
+    struct stream_struct *st;
+    off_t nblocks = (filesize + memsize - 1) / memsize;
+    off_t per = (nblocks + nstreams - 1) / nstreams;
+    off_t written;
+    int i, started, running, err;
+
+    nstreams = (nblocks + per - 1) / per;
+    if (!(st = calloc(nstreams, sizeof(struct stream_struct)))) {
+        errno = ENOMEM;
+        return (off_t)-1;
+    }
+    memset(&fs, 0, sizeof(fs));
+    fs.fd = fd;
+    fs.mem = mem;
+    fs.memsize = memsize;
+    fs.refill = refill;
+    pthread_mutex_init(&fs.lock, NULL);
+    pthread_cond_init(&fs.cond, NULL);
+    for (started = 0; started < nstreams; started++) {
+        st[started].fs = &fs;
+        st[started].start = started * per * memsize;
+        st[started].end = (started + 1) * per * memsize;
+        if (st[started].end > filesize)
+            st[started].end = filesize;
+        pthread_mutex_lock(&fs.lock);
+        fs.running++;
+        pthread_mutex_unlock(&fs.lock);
+        if ((err = pthread_create(&st[started].thd, NULL, stream_writer,
+                                  &st[started]))) {
+            pthread_mutex_lock(&fs.lock);
+            fs.running--;
+            if (!fs.err)
+                fs.err = err;
+            pthread_mutex_unlock(&fs.lock);
+            break;
+        }
+    }
+    written = 0;
+    pthread_mutex_lock(&fs.lock);
+    do {
+        while (fs.running > 0 && fs.written == written)
+            pthread_cond_wait(&fs.cond, &fs.lock);
+        written = fs.written;
+        running = fs.running;
+        pthread_mutex_unlock(&fs.lock);
+        if (progress)
+            progress(arg, (double)written/filesize);
+        pthread_mutex_lock(&fs.lock);
+    } while (running > 0);
+    err = fs.err;
+    pthread_mutex_unlock(&fs.lock);
+    for (i = 0; i < started; i++)
+        (void)pthread_join(st[i].thd, NULL);
+    pthread_mutex_destroy(&fs.lock);
+    pthread_cond_destroy(&fs.cond);
+    free(st);
+    if (err) {
+        errno = err;
+        return (off_t)-1;
+    }
+    return written;
+}
+#else
+static off_t
+fill_streamed(int fd, off_t filesize, unsigned char *mem, int memsize,
+              progress_t progress, void *arg, refill_t refill, int nstreams)
+{
+    errno = ENOSYS;     /* fill_nstreams() never asks for this */
+    return (off_t)-1;
+}
+#endif
+
+/* Pick the number of regions to write 'path' in parallel.  Streams are
+ * written synchronously, so unless set_fill_streams() asked for them,
+ * they are only used where io_uring won't be.
+ */
+static int
+fill_nstreams(char *path, off_t filesize, int memsize)
+{
+    static bool reported = false;
+    int n = 1;
+#if WITH_PTHREADS
+    bool uring = (io_engine == IO_AUTO || io_engine == IO_URING)
+                 && uring_available();
+    int rot;
+
+    n = fill_streams;
+    if (n == 0) {
+        n = 1;
+        if (filetype(path) == FILE_BLOCK && getrotational(path, &rot) == 0
+                                         && rot == 0 && !uring)
+            n = FILL_STREAMS;
+    }
+    if (n > (filesize + memsize - 1) / memsize)
+        n = (filesize + memsize - 1) / memsize;
+    if (n > 1 && fill_verbose && !reported) {
+        if (io_engine == IO_URING)
+            fprintf(stderr, "%s: writing %s in %d streams, using write()\n",
+                    prog, path, n);
+        else
+            fprintf(stderr, "%s: writing %s in %d streams\n", prog, path, n);
+        reported = true;
+    }
+#endif
+    return n;
+}
+
+/* Fill file (can be regular or special file) with pattern in mem.
+ * Writes will use memsize blocks.
+ * If 'refill' is non-null, write from a ring of buffers it fills ahead
+ * of the writer instead of from mem (for random fill).
+ * If 'progress' is non-null, call it after each write (for progress meter).
+ * If 'sparse' is true, only scrub first and last blocks (for testing).
+ * The number of bytes written is returned.
+ * If 'creat' is true, open with O_CREAT and allow ENOSPC to be non-fatal.
+ * Non-rotational block devices without io_uring (or any file, with
+ * set_fill_streams()) are written as several parallel streams, unless
+ * 'sparse' or 'creat' is set.
+ * Files that cannot be opened with O_DIRECT are written back to the device
+ * a window at a time as the fill goes.
+ */
+off_t
+fillfile(char *path, off_t filesize, unsigned char *mem, int memsize,
+         progress_t progress, void *arg, refill_t refill,
+         bool sparse, bool creat)
+{
+    int fd = -1;
+    off_t n;
+    off_t written = 0LL;
+    int openflags = O_WRONLY;
+    ring_t rp = NULL;
+    struct slot_struct *sp = NULL;
+    unsigned char *buf = mem;
+    uring_t up;
+    int nstreams = 1;
+    struct writeback_struct wb;
+    int blksize = memsize;
+    int tail;
+    bool spliced = false;
+
+    if (!sparse && !creat && use_mmap(path, memsize)) {
+        written = fill_mmap(path, filesize, mem, memsize, progress, arg,
+                            refill);
+        if (written != 0)
+            return written;
+    }
+    if (creat)
+        openflags |= O_CREAT;
+    fd = open_direct(path, openflags);
+    if (fd < 0)
+        goto error;
+    tail = filesize - direct_body(fd, path, filesize);
+    filesize -= tail;
+    if (!sparse && !creat)
+        nstreams = fill_nstreams(path, filesize, memsize);
+    if (filesize > 0 && !refill && !sparse && !creat && use_splice(path)) {
+        written = fill_splice(fd, filesize, mem, memsize, progress, arg);
+        if (written == (off_t)-1)
+            goto error;
+        spliced = true; /* splice(2) ignores --dsync, so flush at close */
+    }
+    if (written == filesize) {
+        /* tail only, or spliced */
+    } else if (nstreams > 1) {
+        written = fill_streamed(fd, filesize, mem, memsize, progress, arg,
+                                refill, nstreams);
+        if (written == (off_t)-1)
+            goto error;
+    } else if (!sparse && io_uring_setup(&up, fd)) {
+        written = fill_uring(up, fd, filesize, mem, memsize, progress, arg,
+                             refill, creat);
+        uring_destroy(up);
+        if (written == (off_t)-1)
+            goto error;
+    } else {
+        wb_init(&wb, fd, 0, memsize);
+        do {
+            if (written + memsize > filesize)
+                memsize = filesize - written;
+            if (refill && !sparse) {
+                if (!rp)
+                    if (ring_create(&rp, refill, memsize, filesize) < 0)
+                        goto error;
+                if (!(sp = ring_get(rp)))
+                    goto error;
+                assert(sp->offset == written && sp->size == memsize);
+                buf = sp->buf;
+            }
+            if (sparse && !(written == 0)
+                       && !(written + memsize == filesize)) {
+                if (lseek(fd, memsize, SEEK_CUR) < 0)
+                    goto error;
+                written += memsize;
+            } else {
+                if (refill && sparse && refill(buf, memsize, written) < 0)
+                    goto error;
+                n = write_block(fd, buf, memsize, -1);
+                if (sp) {
+                    ring_put(rp, sp);
+                    sp = NULL;
+                }
+                if (creat && n < 0 && errno == ENOSPC)
+                    break;
+                if (n == 0) {
+                    errno = EINVAL; /* write past end of device? */
+                    goto error;
+                } else if (n < 0)
+                    goto error;
+                written += n;
+                wb_advance(&wb, written);
+            }
+            if (progress)
+                progress(arg, (double)written/filesize);
+        } while (written < filesize);
+    }
+    n = sync_close(fd, filesize, fill_dsync && !spliced);
+    fd = -1;
+    if (n < 0)
+        goto error;
+    if (tail > 0 && written == filesize) {
+        buf = mem + filesize % blksize;
+        if (refill) {
+            if (!(buf = alloc_buffer(tail))) {
+                errno = ENOMEM;
+                goto error;
+            }
+            if (refill(buf, tail, filesize) < 0) {
+                free(buf);
+                goto error;
+            }
+        }
+        n = tail_io(path, true, buf, tail, filesize);
+        if (refill)
+            free(buf);
+        if (n < 0 && !(creat && errno == ENOSPC))
+            goto error;
+        if (n > 0)
+            written += n;
+        if (progress)
+            progress(arg, 1.0);
+    }
+    if (rp)
+        ring_destroy(rp);
+    return written;
+error:
+    if (rp)
+        ring_destroy(rp);
+    if (fd != -1)
+        (void)close(fd);
+    return (off_t)-1;
+}
+
+/* Fill 'count' files of sizes 'sizes' in lockstep, writing each block
+ * (from mem, or from the refill ring) to every file that extends that far
+ * before moving on to the next, so random data is generated once for all
+ * of them.  Each file is written back a window at a time as for
+ * fillfile().  If 'progress' is non-null, call it after each block.
+ * The number of bytes written to the largest file is returned.  On error,
+ * -1 is returned and the index of the failing file is stored in 'failed'.
+ */
+off_t
+fillfiles(char **paths, off_t *sizes, int count, unsigned char *mem,
+          int memsize, progress_t progress, void *arg, refill_t refill,
+          int *failed)
+{
+    int *fd;
+    struct writeback_struct *wb;
+    int i, len, tail;
+    off_t n, filesize = 0;
+    off_t written = 0LL;
+    ring_t rp = NULL;
+    struct slot_struct *sp = NULL;
+    unsigned char *buf = mem;
+
+    if (!(fd = malloc(count * sizeof(int)))) {
+        errno = ENOMEM;
+        *failed = 0;
+        return (off_t)-1;
+    }
+    if (!(wb = malloc(count * sizeof(struct writeback_struct)))) {
+        free(fd);
+        errno = ENOMEM;
+        *failed = 0;
+        return (off_t)-1;
+    }
+    for (i = 0; i < count; i++)
+        fd[i] = -1;
+    for (i = 0; i < count; i++) {
+        if ((fd[i] = open_direct(paths[i], O_WRONLY)) < 0)
+            goto error;
+        wb_init(&wb[i], fd[i], 0, memsize);
+        if (sizes[i] > filesize)
+            filesize = sizes[i];
+    }
+    i = 0;
+    if (refill && ring_create(&rp, refill, memsize, filesize) < 0)
+        goto error;
+    do {
+        if (written + memsize > filesize)
+            memsize = filesize - written;
+        if (rp) {
+            if (!(sp = ring_get(rp))) {
+                i = 0;  /* no target to blame in particular */
+                goto error;
+            }
+            assert(sp->offset == written && sp->size == memsize);
+            buf = sp->buf;
+        }
+        for (i = 0; i < count; i++) {
+            if (written >= sizes[i])
+                continue;
+            len = memsize;
+            if (written + len > sizes[i])
+                len = sizes[i] - written;
+            tail = 0;
+            if (written + len == sizes[i])
+                tail = sizes[i] - direct_body(fd[i], paths[i], sizes[i]);
+            n = len;
+            if (tail < len)
+                n = write_block(fd[i], buf, len - tail, -1);
+            if (n > 0 && tail > 0)
+                n = tail_io(paths[i], true, buf + len - tail, tail,
+                            sizes[i] - tail);
+            if (n == 0) {
+                errno = EINVAL; /* write past end of device? */
+                goto error;
+            } else if (n < 0)
+                goto error;
+            wb_advance(&wb[i], written + len);
+        }
+        if (sp) {
+            ring_put(rp, sp);
+            sp = NULL;
+        }
+        written += memsize;
+        if (progress)
+            progress(arg, (double)written/filesize);
+    } while (written < filesize);
+    for (i = 0; i < count; i++) {
+        n = sync_close(fd[i], sizes[i], fill_dsync);
+        fd[i] = -1;
+        if (n < 0)
+            goto error;
+    }
+    if (rp)
+        ring_destroy(rp);
+    free(wb);
+    free(fd);
+    return written;
+error:
+    *failed = i;
+    if (rp)
+        ring_destroy(rp);
+    for (i = 0; i < count; i++)
+        if (fd[i] != -1)
+            (void)close(fd[i]);
+    free(wb);
+    free(fd);
+    return (off_t)-1;
+}
+
+#if defined(BLKZEROOUT)
+/* Zero the block device 'path' with BLKZEROOUT, which lets a device that
+ * supports write-zeroes (or write-same) do the work itself, and otherwise
+ * has the kernel write zero pages without copying from user memory.
+ * The ioctl works in logical sectors, so a partial sector at the end is
+ * written from 'mem', which must hold zeros.  If 'progress' is non-null,
+ * call it after each ZERO_CHUNK.  The number of bytes zeroed is returned.
+ * On failure, including a device or kernel without the ioctl, -1 is
+ * returned and the caller should fall back to fillfile().
+ */
+off_t
+zerofile(char *path, off_t filesize, unsigned char *mem, int memsize,
+         progress_t progress, void *arg)
+{
+    int fd = -1;
+    off_t n;
+    off_t written = 0LL;
+    off_t aligned;
+    unsigned long long range[2];
+    topology_t t;
+    int sector = 512;
+
+    if (filetype(path) != FILE_BLOCK) {
+        errno = ENOTBLK;
+        goto error;
+    }
+    if (gettopology(path, &t) == 0 && t.logical > 0)
+        sector = t.logical;
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        goto error;
+    aligned = filesize - filesize % sector;
+    while (written < aligned) {
+        range[0] = written;
+        range[1] = aligned - written;
+        if (range[1] > ZERO_CHUNK)
+            range[1] = ZERO_CHUNK;
+        if (ioctl(fd, BLKZEROOUT, range) < 0)
+            goto error;
+        written += range[1];
+        if (progress)
+            progress(arg, (double)written/filesize);
+    }
+    while (written < filesize) {
+        n = filesize - written;
+        if (n > memsize)
+            n = memsize;
+        n = pwrite_all(fd, mem, n, written);
+        if (n == 0) {
+            errno = EINVAL; /* write past end of device? */
+            goto error;
+        } else if (n < 0)
+            goto error;
+        written += n;
+        if (progress)
+            progress(arg, (double)written/filesize);
+    }
+    n = sync_close(fd, filesize, false);
+    fd = -1;
+    if (n < 0)
+        goto error;
+    return written;
+error:
+    if (fd != -1)
+        (void)close(fd);
+    return (off_t)-1;
+}
+#else
+off_t
+zerofile(char *path, off_t filesize, unsigned char *mem, int memsize,
+         progress_t progress, void *arg)
+{
+    errno = ENOSYS;
+    return (off_t)-1;
+}
+#endif
+
+/* Read-ahead for the synchronous checkfile() loop: reader threads pread()
+ * the blocks of the file into a ring of buffers, block b into slot
+ * b % depth, so up to depth - 1 reads are in flight while the caller
+ * compares the block before them.  The io_uring engine gets the same
+ * overlap from check_uring().  Like io_uring, it is only used where
+ * positional() reads are safe.
+ */
+struct rahead_struct {
+    int fd;
+    off_t filesize;
+    int memsize;
+    int depth;
+    struct rbuf_struct {
+        unsigned char *buf;
+        off_t block;    /* block number being read into buf */
+        int len;
+        int err;        /* errno of a failed read, or 0 */
+        bool ready;
+    } *slot;
+#if WITH_PTHREADS
+    pthread_t *thd;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t next_read;    /* next block to be claimed by a reader */
+    off_t released;     /* blocks the caller is done with */
+    bool shutdown;
+#endif
+};
+typedef struct rahead_struct *rahead_t;
+
+#if WITH_PTHREADS
+static void *
+rahead_reader(void *arg)
+{
+    rahead_t ra = (rahead_t)arg;
+    off_t nblocks = (ra->filesize + ra->memsize - 1) / ra->memsize;
+    struct rbuf_struct *rb;
+    off_t offset;
+    int n, err;
+
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->shutdown && ra->next_read < nblocks) {
+        if (ra->next_read >= ra->released + ra->depth) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        rb = &ra->slot[ra->next_read % ra->depth];
+        rb->block = ra->next_read++;
+        pthread_mutex_unlock(&ra->lock);
+
+        offset = rb->block * ra->memsize;
+        rb->len = ra->memsize;
+        if (rb->len > ra->filesize - offset)
+            rb->len = ra->filesize - offset;
+        n = pread_all(ra->fd, rb->buf, rb->len, offset);
+        err = n < 0 ? errno : n == 0 ? EINVAL : 0; /* EINVAL: early EOF */
+
+        pthread_mutex_lock(&ra->lock);
+        rb->err = err;
+        rb->ready = true;
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+static void
+rahead_destroy(rahead_t ra)
+{
+    int i;
+
+    if (ra->thd) {
+        pthread_mutex_lock(&ra->lock);
+        ra->shutdown = true;
+        pthread_cond_broadcast(&ra->cond);
+        pthread_mutex_unlock(&ra->lock);
+        for (i = 0; i < ra->nthreads; i++)
+            pthread_join(ra->thd[i], NULL);
+        free(ra->thd);
+    }
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->cond);
+    for (i = 0; i < ra->depth; i++)
+        if (ra->slot[i].buf)
+            free(ra->slot[i].buf);
+    free(ra->slot);
+    free(ra);
+}
+
+/* Start reading 'fd' ahead, 'memsize' bytes at a time.  The depth is
+ * that of check_uring(): --queue-depth, capped at IO_READBUFS.
+ */
+static int
+rahead_create(rahead_t *rap, int fd, off_t filesize, int memsize)
+{
+    rahead_t ra;
+    off_t nblocks = (filesize + memsize - 1) / memsize;
+    int i, err;
+
+    if (!(ra = malloc(sizeof(struct rahead_struct))))
+        goto nomem;
+    memset(ra, 0, sizeof(struct rahead_struct));
+    ra->fd = fd;
+    ra->filesize = filesize;
+    ra->memsize = memsize;
+    ra->depth = io_depth ? io_depth : IO_DEPTH;
+    if (ra->depth > IO_READBUFS)
+        ra->depth = IO_READBUFS;
+    if (ra->depth > nblocks)
+        ra->depth = nblocks;
+    if (ra->depth < 2)
+        ra->depth = 2;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    if (!(ra->slot = malloc(ra->depth * sizeof(struct rbuf_struct)))) {
+        free(ra);
+        goto nomem;
+    }
+    memset(ra->slot, 0, ra->depth * sizeof(struct rbuf_struct));
+    for (i = 0; i < ra->depth; i++) {
+        if (!(ra->slot[i].buf = alloc_buffer(memsize))) {
+            rahead_destroy(ra);
+            goto nomem;
+        }
+    }
+    ra->nthreads = ra->depth - 1;
+    if (!(ra->thd = malloc(ra->nthreads * sizeof(pthread_t)))) {
+        rahead_destroy(ra);
+        goto nomem;
+    }
+    for (i = 0; i < ra->nthreads; i++) {
+        if ((err = pthread_create(&ra->thd[i], NULL, rahead_reader, ra))) {
+            ra->nthreads = i;
+            rahead_destroy(ra);
+            errno = err;
+            goto error;
+        }
+    }
+    *rap = ra;
+    return 0;
+nomem:
+    errno = ENOMEM;
+error:
+    return -1;
+}
+
+/* Wait for block 'b' to be read.  Blocks must be taken in order and each
+ * handed back with rahead_put() before the next is taken.
+ */
+static struct rbuf_struct *
+rahead_get(rahead_t ra, off_t b)
+{
+    struct rbuf_struct *rb = &ra->slot[b % ra->depth];
+
+    pthread_mutex_lock(&ra->lock);
+    while (!rb->ready)
+        pthread_cond_wait(&ra->cond, &ra->lock);
+    pthread_mutex_unlock(&ra->lock);
+    assert(rb->block == b);
+    return rb;
+}
+
+static void
+rahead_put(rahead_t ra, struct rbuf_struct *rb)
+{
+    pthread_mutex_lock(&ra->lock);
+    rb->ready = false;
+    ra->released++;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+#else
+static int
+rahead_create(rahead_t *rap, int fd, off_t filesize, int memsize)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static void
+rahead_destroy(rahead_t ra)
+{
+}
+
+static struct rbuf_struct *
+rahead_get(rahead_t ra, off_t b)
+{
+    return NULL;
+}
+
+static void
+rahead_put(rahead_t ra, struct rbuf_struct *rb)
+{
+}
+#endif
+
+/* Verify that file was filled with 'mem' patterns.
+ * If 'pat' is non-null, compare each block directly against that fixed
+ * pattern instead, and 'mem' is not used.  If 'refill' is non-null,
+ * compare against the data it regenerates for each offset (for random
+ * fill), using the same ring of buffers as fillfile().
+ * On a mismatch, the offset of the first bad byte is returned and the
+ * number of bad bytes in its block is put in '*mismatchp'.
+ */
+off_t
+checkfile(char *path, off_t filesize, unsigned char *mem, int memsize,
+          progress_t progress, void *arg, refill_t refill,
+          const pattern_t *pat, bool sparse, size_t *mismatchp)
+{
+    int fd = -1;
+    off_t n;
+    off_t verified = 0LL;
+    unsigned char *buf = NULL;
+    unsigned char *expect = mem;
+    int openflags = O_RDONLY;
+    ring_t rp = NULL;
+    struct slot_struct *sp = NULL;
+    rahead_t ra = NULL;
+    struct rbuf_struct *rb = NULL;
+    unsigned char *data;
+    uring_t up;
+    int blksize = memsize;
+    int tail;
+    size_t bad, first = 0;
+
+    *mismatchp = 0;
+    if (!sparse && use_mmap(path, memsize))
+        return check_mmap(path, filesize, mem, memsize, progress, arg,
+                          refill, pat, mismatchp);
+    fd = open_direct(path, openflags);
+    if (fd < 0)
+        goto error;
+    tail = filesize - direct_body(fd, path, filesize);
+    filesize -= tail;
+    if (filesize == 0)
+        verified = 0;   /* tail only */
+    else if (!sparse && io_uring_setup(&up, fd)) {
+        verified = check_uring(up, filesize, mem, memsize, progress, arg,
+                               refill, pat, mismatchp);
+        uring_destroy(up);
+        if (verified == (off_t)-1)
+            goto error;
+    } else {
+        if (sparse || filesize <= memsize || !positional(fd)
+                   || rahead_create(&ra, fd, filesize, memsize) < 0) {
+            ra = NULL;  /* one blocking read at a time */
+            if (!(buf = alloc_buffer(memsize)))
+                goto nomem;
+        }
+        do {
+            if (verified + memsize > filesize)
+                memsize = filesize - verified;
+            if (sparse && !(verified == 0)
+                       && !(verified + memsize == filesize)) {
+                if (lseek(fd, memsize, SEEK_CUR) < 0)
+                    goto error;
+                verified += memsize;
+            } else {
+                if (refill && !sparse) {
+                    if (!rp)
+                        if (ring_create(&rp, refill, memsize, filesize) < 0)
+                            goto error;
+                    if (!(sp = ring_get(rp)))
+                        goto error;
+                    assert(sp->offset == verified && sp->size == memsize);
+                    expect = sp->buf;
+                } else if (refill && refill(mem, memsize, verified) < 0)
+                    goto error;
+                if (ra) {
+                    rb = rahead_get(ra, verified / blksize);
+                    if (rb->err) {
+                        errno = rb->err;
+                        goto error;
+                    }
+                    data = rb->buf;
+                } else {
+                    n = read_all(fd, buf, memsize);
+                    if (n < 0)
+                        goto error;
+                    if (n == 0) {
+                        errno = EINVAL; /* early EOF */
+                        goto error;
+                    }
+                    data = buf;
+                }
+                bad = check_block(data, memsize, verified, blksize, pat,
+                                  expect, &first);
+                if (bad > 0) {
+                    *mismatchp = bad;
+                    verified += first;
+                    break; /* return < filesize means verification failure */
+                }
+                if (sp) {
+                    ring_put(rp, sp);
+                    sp = NULL;
+                }
+                if (ra)
+                    rahead_put(ra, rb);
+                verified += memsize;
+            }
+            if (progress)
+                progress(arg, (double)verified/filesize);
+        } while (verified < filesize);
+        if (ra) {
+            rahead_destroy(ra);
+            ra = NULL;
+        }
+    }
+    if (close(fd) < 0)
+        goto error;
+    fd = -1;
+    if (tail > 0 && verified == filesize) {
+        if (buf) {
+            free(buf);
+            buf = NULL;
+        }
+        if (!(buf = alloc_buffer(tail)))
+            goto nomem;
+        expect = pat ? NULL : mem + filesize % blksize;
+        if (refill) {
+            if (!(expect = alloc_buffer(tail)))
+                goto nomem;
+            if (refill(expect, tail, filesize) < 0) {
+                free(expect);
+                goto error;
+            }
+        }
+        n = tail_io(path, false, buf, tail, filesize);
+        if (n == tail) {
+            bad = check_block(buf, tail, filesize, blksize, pat, expect,
+                              &first);
+            if (bad > 0) {
+                *mismatchp = bad;
+                verified += first;
+            } else
+                verified += tail;
+        }
+        if (refill)
+            free(expect);
+        if (n < 0)
+            goto error;
+        if (progress && verified > filesize)
+            progress(arg, 1.0);
+    }
+    if (rp)
+        ring_destroy(rp);
+    if (buf)
+        free(buf);
+    return verified;
+nomem:
+    errno = ENOMEM;
+error:
+    if (ra)
+        rahead_destroy(ra);
+    if (rp)
+        ring_destroy(rp);
+    if (buf)
+        free (buf);
+    if (fd != -1)
+        (void)close(fd);
+    return (off_t)-1;
+}
+
+/* Verify-behind: write a fixed pattern a region of VB_REGION bytes at a
+ * time, flush each region and hand it to a reader thread that reads it
+ * back and compares it with the pattern while the writer goes on to the
+ * next.  On devices that serve reads and writes at once, most of the
+ * verify sweep is then hidden behind the write sweep.
+ */
+struct behind_struct {
+    char *path;
+    off_t filesize;
+    off_t body;         /* direct I/O part; the rest goes through tail_io() */
+    int memsize;
+    const pattern_t *pat;
+#if WITH_PTHREADS
+    pthread_t thd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t durable;      /* bytes written and flushed */
+    off_t checked;      /* bytes read back and found good */
+    bool done;          /* writer finished (or failed) */
+    bool running;       /* reader still going */
+    bool failed;        /* reader found a mismatch or error */
+    size_t mismatch;    /* bad bytes in the block at 'checked' */
+    int err;            /* reader error */
+#endif
+};
+
+#if WITH_PTHREADS
+#define VB_REGION       (64*1024*1024)  /* bytes flushed per handoff */
+
+static void *
+behind_reader(void *arg)
+{
+    behind_t b = (behind_t)arg;
+    unsigned char *buf = NULL;
+    off_t end, checked = 0;
+    size_t bad = 0, first = 0;
+    int fd = -1, len, n, err = 0;
+
+    if (!(buf = alloc_buffer(b->memsize)))
+        err = ENOMEM;
+    else if ((fd = open_direct(b->path, O_RDONLY)) < 0)
+        err = errno;
+    while (!err && bad == 0) {
+        pthread_mutex_lock(&b->lock);
+        while (b->durable == checked && !b->done)
+            pthread_cond_wait(&b->cond, &b->lock);
+        end = b->durable;
+        pthread_mutex_unlock(&b->lock);
+        if (end == checked)
+            break;      /* writer finished or failed */
+        while (!err && bad == 0 && checked < end) {
+            len = b->memsize;
+            if (len > end - checked)
+                len = end - checked;
+            if (checked < b->body && len > b->body - checked)
+                len = b->body - checked;    /* the tail is read buffered */
+            if (checked >= b->body)
+                n = tail_io(b->path, false, buf, len, checked);
+            else
+                n = read_all(fd, buf, len);
+            if (n == 0)
+                err = EINVAL;   /* early EOF */
+            else if (n < 0)
+                err = errno;
+            else if ((bad = check_block(buf, len, checked, b->memsize,
+                                        b->pat, NULL, &first)) > 0)
+                checked += first;
+            else
+                checked += len;
+            pthread_mutex_lock(&b->lock);
+            b->checked = checked;
+            b->mismatch = bad;
+            pthread_cond_broadcast(&b->cond);
+            pthread_mutex_unlock(&b->lock);
+        }
+    }
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+    if (fd >= 0)
+        (void)posix_fadvise(fd, 0, b->filesize, POSIX_FADV_DONTNEED);
+#endif
+    if (fd >= 0)
+        (void)close(fd);
+    if (buf)
+        free(buf);
+    pthread_mutex_lock(&b->lock);
+    b->err = err;
+    b->failed = (err != 0 || bad > 0);
+    b->running = false;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+/* Make the first 'end' bytes of the file available to the reader.
+ */
+static void
+behind_post(behind_t b, off_t end, bool done)
+{
+    pthread_mutex_lock(&b->lock);
+    b->durable = end;
+    if (done)
+        b->done = true;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void
+behind_destroy(behind_t b)
+{
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+    free(b);
+}
+
+/* Fill 'path' with the fixed pattern 'pat' held in 'mem', verifying it
+ * behind the writer.  Writes are synchronous, in 'memsize' blocks.  If
+ * the reader has found a mismatch by the end of a region, writing stops
+ * there.  The number of bytes written is returned, and the verification
+ * must then be collected with checkfile_behind(), which frees '*bp'.
+ */
+off_t
+fillfile_behind(char *path, off_t filesize, unsigned char *mem, int memsize,
+                progress_t progress, void *arg, const pattern_t *pat,
+                behind_t *bp)
+{
+    behind_t b;
+    off_t region, start, written = 0LL;
+    int fd, len, n, err;
+    bool failed = false;
+
+    if (!(b = calloc(1, sizeof(struct behind_struct)))) {
+        errno = ENOMEM;
+        return (off_t)-1;
+    }
+    b->path = path;
+    b->filesize = filesize;
+    b->memsize = memsize;
+    b->pat = pat;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    if ((fd = open_direct(path, O_WRONLY)) < 0) {
+        behind_destroy(b);
+        return (off_t)-1;
+    }
+    b->body = direct_body(fd, path, filesize);
+    b->running = true;
+    if ((err = pthread_create(&b->thd, NULL, behind_reader, b))) {
+        (void)close(fd);
+        behind_destroy(b);
+        errno = err;
+        return (off_t)-1;
+    }
+    region = VB_REGION - VB_REGION % memsize;
+    if (region < memsize)
+        region = memsize;
+    while (!failed && written < b->body) {
+        len = memsize;
+        if (len > b->body - written)
+            len = b->body - written;
+        n = write_block(fd, mem, len, written);
+        if (n == 0)
+            errno = EINVAL; /* write past end of device? */
+        if (n <= 0)
+            goto error;
+        written += n;
+        if (written % region == 0 || written == b->body) {
+            if (!fill_dsync && fdatasync(fd) < 0 && errno != EINVAL)
+                goto error;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+            /* make the reader go to the device, not the page cache */
+            start = (written - 1) / region * region;
+            (void)posix_fadvise(fd, start, written - start,
+                                POSIX_FADV_DONTNEED);
+#endif
+            behind_post(b, written, false);
+            /* no point writing the rest of a device known to be bad */
+            pthread_mutex_lock(&b->lock);
+            failed = b->failed;
+            pthread_mutex_unlock(&b->lock);
+        }
+        if (progress)
+            progress(arg, (double)written/filesize);
+    }
+    if (sync_close(fd, b->body, true) < 0) {
+        fd = -1;
+        goto error;
+    }
+    fd = -1;
+    if (!failed && written < filesize) {
+        n = tail_io(path, true, mem + written % memsize, filesize - written,
+                    written);
+        if (n < 0)
+            goto error;
+        written += n;
+        if (progress)
+            progress(arg, 1.0);
+    }
+    behind_post(b, written, true);
+    *bp = b;
+    return written;
+error:
+    err = errno;
+    if (fd != -1)
+        (void)close(fd);
+    behind_post(b, b->durable, true);
+    (void)pthread_join(b->thd, NULL);
+    behind_destroy(b);
+    errno = err;
+    return (off_t)-1;
+}
+
+/* Wait for the reader started by fillfile_behind() to finish, calling
+ * 'progress' as it goes.  Return values are as for checkfile().
+ */
+off_t
+checkfile_behind(behind_t b, progress_t progress, void *arg,
+                 size_t *mismatchp)
+{
+    off_t checked = -1;
+    bool running;
+    int err;
+
+    pthread_mutex_lock(&b->lock);
+    do {
+        while (b->running && b->checked == checked)
+            pthread_cond_wait(&b->cond, &b->lock);
+        checked = b->checked;
+        running = b->running;
+        pthread_mutex_unlock(&b->lock);
+        if (progress)
+            progress(arg, (double)checked/b->filesize);
+        pthread_mutex_lock(&b->lock);
+    } while (running);
+    *mismatchp = b->mismatch;
+    err = b->err;
+    pthread_mutex_unlock(&b->lock);
+    (void)pthread_join(b->thd, NULL);
+    behind_destroy(b);
+    if (err) {
+        errno = err;
+        return (off_t)-1;
+    }
+    return checked;
+}
+#else
+/* Without threads, write and then verify as usual.
+ */
+off_t
+fillfile_behind(char *path, off_t filesize, unsigned char *mem, int memsize,
+                progress_t progress, void *arg, const pattern_t *pat,
+                behind_t *bp)
+{
+    behind_t b;
+    off_t written;
+
+    if (!(b = calloc(1, sizeof(struct behind_struct)))) {
+        errno = ENOMEM;
+        return (off_t)-1;
+    }
+    written = fillfile(path, filesize, mem, memsize, progress, arg, NULL,
+                       false, false);
+    if (written == (off_t)-1) {
+        free(b);
+        return (off_t)-1;
+    }
+    b->path = path;
+    b->filesize = written;
+    b->memsize = memsize;
+    b->pat = pat;
+    *bp = b;
+    return written;
+}
+
+off_t
+checkfile_behind(behind_t b, progress_t progress, void *arg,
+                 size_t *mismatchp)
+{
+    off_t checked;
+
+    checked = checkfile(b->path, b->filesize, NULL, b->memsize, progress,
+                        arg, NULL, b->pat, false, mismatchp);
+    free(b);
+    return checked;
+}
+#endif /* WITH_PTHREADS */
+
+/* Wavefront: write several passes over the file at once, each trailing
+ * the pass before it by WAVE_LAG regions of WAVE_REGION bytes.  A writer
+ * flushes each region before the pass behind it may overwrite it, so
+ * every region still gets the passes in order, each one durable, while
+ * a device with internal parallelism works on several regions at once.
+ */
+struct wave_struct {
+    char *path;
+    off_t filesize;
+    int memsize;
+    const pattern_t *pats;
+    int npats;
+    refill_t refill;
+#if WITH_PTHREADS
+    pthread_t *thd;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t *durable;     /* per pass: bytes written and flushed */
+    int next_pass;      /* next pass to be claimed by a writer */
+    int running;
+    int err;            /* first error seen by any writer */
+#endif
+};
+
+#if WITH_PTHREADS
+#define WAVE_REGION     (64*1024*1024)  /* bytes flushed per handoff */
+#define WAVE_LAG        2               /* regions between passes */
+
+/* Write pass 'k' of 'w', one region at a time.  Random passes take
+ * successive 'filesize' stretches of the refill stream, so each gets
+ * different data.  Returns 0 or an errno value.
+ */
+static int
+wave_write(wave_t w, int k, off_t region)
+{
+    const pattern_t *pat = &w->pats[k];
+    bool random = (pat->ptype == PAT_RANDOM);
+    unsigned char *buf;
+    off_t body, start, end, need, offset = 0;
+    int fd, len, n, err = 0;
+
+    buf = random ? alloc_buffer(w->memsize) : alloc_pattern(*pat, w->memsize);
+    if (!buf)
+        return ENOMEM;
+    if ((fd = open_direct(w->path, O_WRONLY)) < 0) {
+        err = errno;
+        goto done;
+    }
+    body = direct_body(fd, w->path, w->filesize);
+    while (!err && offset < w->filesize) {
+        start = offset;
+        end = offset + region;
+        if (end > w->filesize)
+            end = w->filesize;
+        need = end + WAVE_LAG * region;
+        if (need > w->filesize)
+            need = w->filesize;
+        pthread_mutex_lock(&w->lock);
+        while (k > 0 && !w->err && w->durable[k - 1] < need)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (w->err)
+            err = -1;   /* another writer failed; it reports */
+        pthread_mutex_unlock(&w->lock);
+        while (!err && offset < end) {
+            len = w->memsize;
+            if (len > end - offset)
+                len = end - offset;
+            if (offset < body && len > body - offset)
+                len = body - offset;    /* the tail is written buffered */
+            if (random && w->refill(buf, len, k * w->filesize + offset) < 0)
+                n = -1;
+            else if (offset >= body)
+                n = tail_io(w->path, true,
+                            random ? buf : buf + offset % w->memsize,
+                            len, offset);
+            else
+                n = write_block(fd, buf, len, offset);
+            if (n == 0)
+                err = EINVAL;   /* write past end of device? */
+            else if (n < 0)
+                err = errno;
+            else
+                offset += len;
+        }
+        if (!err && !fill_dsync && fdatasync(fd) < 0 && errno != EINVAL)
+            err = errno;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+        /* keep buffered fallbacks from filling the page cache */
+        if (!err)
+            (void)posix_fadvise(fd, start, end - start, POSIX_FADV_DONTNEED);
+#endif
+        pthread_mutex_lock(&w->lock);
+        if (!err)
+            w->durable[k] = offset;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+    if (close(fd) < 0 && !err)
+        err = errno;
+done:
+    if (random)
+        free(buf);
+    else
+        free_pattern(buf, *pat, w->memsize);
+    return err < 0 ? 0 : err;
+}
+
+static void *
+wave_writer(void *arg)
+{
+    wave_t w = (wave_t)arg;
+    off_t region;
+    int k, err;
+
+    region = WAVE_REGION - WAVE_REGION % w->memsize;
+    if (region < w->memsize)
+        region = w->memsize;
+    pthread_mutex_lock(&w->lock);
+    while (!w->err && w->next_pass < w->npats) {
+        k = w->next_pass++;
+        pthread_mutex_unlock(&w->lock);
+
+        err = wave_write(w, k, region);
+
+        pthread_mutex_lock(&w->lock);
+        if (err && !w->err)
+            w->err = err;
+        pthread_cond_broadcast(&w->cond);
+    }
+    w->running--;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void
+wave_destroy(wave_t w)
+{
+    int i;
+
+    for (i = 0; i < w->nthreads; i++)
+        (void)pthread_join(w->thd[i], NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    if (w->thd)
+        free(w->thd);
+    if (w->durable)
+        free(w->durable);
+    free(w);
+}
+
+/* Start writing the 'npats' passes at 'pats' over 'path' as a wavefront,
+ * with up to 'width' passes in flight.  Random passes are generated with
+ * 'refill'.  Writes are synchronous, in 'memsize' blocks.  Each pass must
+ * then be collected in order with fillfile_wave_pass(), which frees '*wp'
+ * after the last one or on error.  Returns 0, or -1 with errno set
+ * (ENOSYS if threads are not available, or 'path' is a character device,
+ * which is not written at explicit offsets).
+ */
+int
+fillfile_wave(char *path, off_t filesize, const pattern_t *pats, int npats,
+              int memsize, refill_t refill, int width, wave_t *wp)
+{
+    wave_t w;
+    int err;
+
+    if (filetype(path) == FILE_CHAR) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (!(w = calloc(1, sizeof(struct wave_struct))))
+        goto nomem;
+    w->path = path;
+    w->filesize = filesize;
+    w->memsize = memsize;
+    w->pats = pats;
+    w->npats = npats;
+    w->refill = refill;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (width > npats)
+        width = npats;
+    if (width < 1)
+        width = 1;
+    if (!(w->durable = calloc(npats, sizeof(off_t)))
+            || !(w->thd = calloc(width, sizeof(pthread_t)))) {
+        wave_destroy(w);
+        goto nomem;
+    }
+    for (w->nthreads = 0; w->nthreads < width; w->nthreads++) {
+        pthread_mutex_lock(&w->lock);
+        w->running++;
+        pthread_mutex_unlock(&w->lock);
+        if ((err = pthread_create(&w->thd[w->nthreads], NULL, wave_writer,
+                                  w))) {
+            pthread_mutex_lock(&w->lock);
+            w->running--;
+            w->err = err;
+            pthread_cond_broadcast(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+            wave_destroy(w);
+            errno = err;
+            return -1;
+        }
+    }
+    *wp = w;
+    return 0;
+nomem:
+    errno = ENOMEM;
+    return -1;
+}
+
+/* Wait for pass 'k' of the wavefront started by fillfile_wave() to be
+ * written, calling 'progress' as it goes.  Return values are as for
+ * fillfile().
+ */
+off_t
+fillfile_wave_pass(wave_t w, int k, progress_t progress, void *arg)
+{
+    off_t written = -1;
+    int running, err;
+
+    pthread_mutex_lock(&w->lock);
+    do {
+        while (w->running > 0 && !w->err && w->durable[k] == written)
+            pthread_cond_wait(&w->cond, &w->lock);
+        written = w->durable[k];
+        running = w->running;
+        err = w->err;
+        pthread_mutex_unlock(&w->lock);
+        if (progress && !err)
+            progress(arg, (double)written/w->filesize);
+        pthread_mutex_lock(&w->lock);
+    } while (!err && running > 0 && written < w->filesize);
+    pthread_mutex_unlock(&w->lock);
+    if (!err && written < w->filesize)
+        err = EIO;      /* writers quit early without saying why */
+    if (err || k == w->npats - 1)
+        wave_destroy(w);
+    if (err) {
+        errno = err;
+        return (off_t)-1;
+    }
+    return written;
+}
+#else
+int
+fillfile_wave(char *path, off_t filesize, const pattern_t *pats, int npats,
+              int memsize, refill_t refill, int width, wave_t *wp)
+{
+    errno = ENOSYS;     /* the caller writes the passes one at a time */
+    return -1;
+}
+
+off_t
+fillfile_wave_pass(wave_t w, int k, progress_t progress, void *arg)
+{
+    errno = ENOSYS;
+    return (off_t)-1;
+}
+#endif /* WITH_PTHREADS */
+
+void
 disable_threads(void)
 {
     no_threads = 1;
 }
 
+/* Set the number of threads computing random data ahead of the writer.
+ * By default the number adapts to the writer's pace.
+ */
+void
+set_refill_threads(int n)
+{
+    ring_threads = n;
+}
+
+/* Set the number of random data buffers in flight.
+ */
+void
+set_refill_depth(int n)
+{
+    ring_depth = n;
+}
+
+/* Report I/O engine fallbacks and changes to the number of random data
+ * threads on stderr.
+ */
+void
+set_fill_verbose(bool verbose)
+{
+    fill_verbose = verbose;
+}
+
+/* Select the I/O engine: "sync" for read()/write(), "uring" for io_uring,
+ * "mmap" for memory-mapped regular files, "splice" for fixed patterns on
+ * character devices (other files and passes use synchronous I/O), or
+ * "auto" for io_uring when the kernel supports it.  Even when chosen,
+ * io_uring and splice fall back to synchronous I/O for a file if they
+ * can't be used.
+ */
+int
+set_io_engine(const char *name)
+{
+    if (!strcmp(name, "auto"))
+        io_engine = IO_AUTO;
+    else if (!strcmp(name, "sync"))
+        io_engine = IO_SYNC;
+    else if (!strcmp(name, "uring") && uring_available())
+        io_engine = IO_URING;
+#if HAVE_SYS_MMAN_H
+    else if (!strcmp(name, "mmap"))
+        io_engine = IO_MMAP;
+#endif
+#if HAVE_VMSPLICE
+    else if (!strcmp(name, "splice"))
+        io_engine = IO_SPLICE;
+#endif
+    else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Make each write durable before the next (RWF_DSYNC) instead of
+ * flushing the whole file at the end of each pass.
+ */
+void
+set_fill_dsync(bool dsync)
+{
+    fill_dsync = dsync;
+}
+
+/* Set the number of regions written in parallel.  By default this is 1,
+ * or FILL_STREAMS for block devices that are not rotational when io_uring
+ * is not in use.
+ */
+void
+set_fill_streams(int n)
+{
+    fill_streams = n;
+}
+
+/* Set the number of writes kept in flight by the io_uring engine.
+ * Random passes are further limited by the ring depth.
+ */
+void
+set_io_depth(int n)
+{
+    io_depth = n;
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
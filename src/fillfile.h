@@ -9,15 +9,41 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
 \************************************************************/
 
+/* Requires util.h (for bool) and pattern.h to be included first.
+ */
+
 typedef void (*progress_t) (void *arg, double completed);
-typedef void (*refill_t) (unsigned char *mem, int memsize);
+typedef int (*refill_t) (unsigned char *mem, int memsize, off_t offset);
+typedef struct behind_struct *behind_t;
+typedef struct wave_struct *wave_t;
 
 off_t fillfile(char *path, off_t filesize, unsigned char *mem, int memsize,
         progress_t progress, void *arg, refill_t refill,
         bool sparse, bool creat);
+off_t fillfiles(char **paths, off_t *sizes, int count, unsigned char *mem,
+        int memsize, progress_t progress, void *arg, refill_t refill,
+        int *failed);
+off_t zerofile(char *path, off_t filesize, unsigned char *mem, int memsize,
+        progress_t progress, void *arg);
 off_t checkfile(char *path, off_t filesize, unsigned char *mem, int memsize,
-        progress_t progress, void *arg, bool sparse);
+        progress_t progress, void *arg, refill_t refill,
+        const pattern_t *pat, bool sparse, size_t *mismatchp);
+off_t fillfile_behind(char *path, off_t filesize, unsigned char *mem,
+        int memsize, progress_t progress, void *arg, const pattern_t *pat,
+        behind_t *bp);
+off_t checkfile_behind(behind_t b, progress_t progress, void *arg,
+        size_t *mismatchp);
+int   fillfile_wave(char *path, off_t filesize, const pattern_t *pats,
+        int npats, int memsize, refill_t refill, int width, wave_t *wp);
+off_t fillfile_wave_pass(wave_t w, int k, progress_t progress, void *arg);
 void  disable_threads(void);
+void  set_refill_threads(int n);
+void  set_refill_depth(int n);
+void  set_fill_verbose(bool verbose);
+void  set_fill_dsync(bool dsync);
+int   set_io_engine(const char *name);
+void  set_io_depth(int n);
+void  set_fill_streams(int n);
 
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
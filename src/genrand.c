@@ -22,32 +22,92 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <libgen.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "util.h"
 #include "genrand.h"
 #include "hwrand.h"
 
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
 #include "aes.h"
-#elif defined(HAVE_LIBGCRYPT)
+#include "aesni.h"
+#include "chacha.h"
+#if defined(HAVE_LIBGCRYPT)
 #include <gcrypt.h>
 #elif defined(HAVE_OPENSSL)
 #include <openssl/rand.h>
-#endif /* !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL) */
+#include <openssl/evp.h>
+#endif /* HAVE_LIBGCRYPT */
 
 extern char *prog;
 
+/* Random data generators, in the order the 'auto' probe tries them.
+ */
+typedef enum {
+    RNG_AUTO,
+    RNG_AES,        /* built-in stream, table AES-CTR */
+    RNG_AESNI,      /* built-in stream, AES-NI or VAES AES-CTR */
+    RNG_CHACHA,     /* built-in stream, ChaCha20 */
+    RNG_RDRAND,     /* hardware generator, raw */
+    RNG_GCRYPT,     /* libgcrypt */
+    RNG_OPENSSL,    /* OpenSSL libcrypto */
+    RNG_COUNT,
+} rng_t;
+
+static const char *rng_names[RNG_COUNT] = {
+    "auto", "aes", "aesni", "chacha", "rdrand", "gcrypt", "openssl",
+};
+
+#define PROBE_USEC      50000       /* time for the 'auto' probe, in total */
+#define PROBE_BUFSIZE   (256*1024)
+
 static bool no_hwrand = false;
 static hwrand_t gen_hwrand;
+static off_t stream_off;        /* genrand() position in the pass */
+static rng_t rng_req = RNG_AUTO;/* generator requested with set_rng() */
+static rng_t rng_cur = RNG_AUTO;/* generator in use, once initialized */
+static double rng_gbps;         /* 'auto' probe result for rng_cur */
+static bool seeded = false;     /* key material comes from set_seed() */
+static chacha_context seedctx;  /* ChaCha20 keyed with the set_seed() value */
+static unsigned long long seed_block; /* next seedctx block for genseed() */
 
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
 #define PATH_URANDOM    "/dev/urandom"
 
 #define PAYLOAD_SZ  16
 #define KEY_SZ      16
 
-static aes_context  ctx;
-static unsigned char ctr[PAYLOAD_SZ];
+#define RESEED_INTERVAL (16LL*1024*1024*1024) /* keystream bytes per key */
+
+/* Key and base counter for one reseed interval of a stream.
+ */
+struct rkey_struct {
+    aes_context     ctx;
+    aesni_context   nictx;
+    unsigned char   ctr[PAYLOAD_SZ];    /* counter block at interval start */
+    chacha_context  chctx;
+    unsigned long long chblock;         /* ChaCha block at interval start */
+};
+
+/* A keyed AES-CTR or ChaCha20 keystream.  The counter for any byte offset
+ * is derived from the base counter, so disjoint ranges of the stream can
+ * be generated independently (e.g. by several threads) with the same
+ * result as one sequential pass.  Every RESEED_INTERVAL bytes the stream
+ * switches to a fresh key; interval keys are drawn when first needed and
+ * then kept, so any offset can still be regenerated.
+ */
+struct randstream_struct {
+    struct rkey_struct **key;   /* key for each interval, or NULL */
+    int nkeys;                  /* length of 'key' array */
+#if WITH_PTHREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+static randstream_t stream;     /* stream used by genrand() */
+static aesctr_t     aes_ctr;    /* hardware AES-CTR, if available */
+static hwrand_t     gen_hwseed; /* hardware seed source, if available */
+static chachafn_t   chacha_fn;  /* ChaCha20 kernel, if that is the cipher */
 
 #if HAVE_RAND_R
 static unsigned int seed;
@@ -58,19 +118,20 @@ static struct random_data rdata;
 #error Neither rand_r nor random_r are available
 #endif
 
-/* Increment 128 bit counter.
+/* Add 'n' to 128 bit counter.
  * NOTE: we are not concerned with endianness here since the counter is
  * just sixteen bytes of payload to AES and outside of this function isn't
  * operated upon numerically.
  */
 static void
-incr128(unsigned char *val)
+add128(unsigned char *val, unsigned long long n)
 {
     unsigned long long *t = (unsigned long long *)val;
 
     assert(sizeof(unsigned long long) == 8);
     assert(PAYLOAD_SZ == 16);
-    if (++t[0] == 0)
+    t[0] += n;
+    if (t[0] < n)
         ++t[1];
 }
 
@@ -115,45 +176,549 @@ error:
     return -1;
 }
 
-/* Pick new (random) key and counter values.
+/* Fill 'buf' with seed material: /dev/urandom, mixed with the hardware
+ * seed source when there is one, so it is never weaker than either alone.
+ * After set_seed(), the next block of a ChaCha20 keystream keyed with the
+ * seed instead, so that a run can be reproduced.
  */
-int
-churnrand(void)
+static int
+genseed(unsigned char *buf, int buflen)
 {
-    unsigned char key[KEY_SZ];
+    unsigned char hw[CHACHA_KEY_SZ];
+    unsigned char blk[CHACHA_BLOCK_SZ];
+    int i;
 
-    if (genrandraw(ctr, PAYLOAD_SZ) < 0)
+    assert(buflen <= (int)sizeof(hw));
+    if (seeded) {
+        chacha_ref(&seedctx, seed_block++, blk, CHACHA_BLOCK_SZ);
+        memcpy(buf, blk, buflen);
+        return 0;
+    }
+    if (genrandraw(buf, buflen) < 0)
+        return -1;
+    if (gen_hwseed && gen_hwseed(hw, buflen)) {
+        for (i = 0; i < buflen; i++)
+            buf[i] ^= hw[i];
+    }
+    return 0;
+}
+
+/* Draw a new key and base counter into 'k'.
+ */
+static int
+rkey_init(struct rkey_struct *k)
+{
+    unsigned char key[CHACHA_KEY_SZ];
+    unsigned char nonce[CHACHA_NONCE_SZ];
+
+    if (chacha_fn) {
+        if (genseed(key, CHACHA_KEY_SZ) < 0)
+            goto error;
+        if (genseed(nonce, CHACHA_NONCE_SZ) < 0)
+            goto error;
+        chacha_set_key(&k->chctx, key, nonce);
+        k->chblock = 0;
+        return 0;
+    }
+    if (genseed(k->ctr, PAYLOAD_SZ) < 0)
         goto error;
-    if (genrandraw(key, KEY_SZ) < 0)
+    if (genseed(key, KEY_SZ) < 0)
         goto error;
-    if (aes_set_key(&ctx, key, KEY_SZ*8) != 0) {
+    if (aes_set_key(&k->ctx, key, KEY_SZ*8) != 0) {
         errno = EINVAL;
         goto error;
     }
+    if (aes_ctr)
+        aesni_set_key(&k->nictx, &k->ctx);
+    return 0;
+error:
+    return -1;
+}
+
+static void
+rkey_free(randstream_t r)
+{
+    int i;
+
+    for (i = 0; i < r->nkeys; i++) {
+        if (r->key[i]) {
+            memset(r->key[i], 0, sizeof(struct rkey_struct));
+            free(r->key[i]);
+        }
+    }
+    free(r->key);
+    r->key = NULL;
+    r->nkeys = 0;
+}
+
+/* Return the key for interval 'n' of 'r', drawing keys for it and any
+ * earlier intervals that do not have one yet.  Caller holds r->lock.
+ * If seed material cannot be had mid-pass, the previous interval's
+ * keystream simply continues.
+ */
+static struct rkey_struct *
+rkey_get(randstream_t r, int n)
+{
+    struct rkey_struct **key;
+    int i;
+
+    if (n >= r->nkeys) {
+        if (!(key = realloc(r->key, (n + 1) * sizeof(*key))))
+            return NULL;
+        for (i = r->nkeys; i <= n; i++)
+            key[i] = NULL;
+        r->key = key;
+        r->nkeys = n + 1;
+    }
+    for (i = 0; i <= n; i++) {
+        if (r->key[i])
+            continue;
+        if (!(r->key[i] = malloc(sizeof(struct rkey_struct))))
+            return NULL;
+        if (rkey_init(r->key[i]) < 0) {
+            if (i == 0) {
+                free(r->key[i]);
+                r->key[i] = NULL;
+                return NULL;
+            }
+            memcpy(r->key[i], r->key[i - 1], sizeof(struct rkey_struct));
+            add128(r->key[i]->ctr, RESEED_INTERVAL / PAYLOAD_SZ);
+            r->key[i]->chblock += RESEED_INTERVAL / CHACHA_BLOCK_SZ;
+        }
+    }
+    return r->key[n];
+}
+
+/* Pick new (random) key and base counter values for 'r'.
+ */
+int
+randstream_churn(randstream_t r)
+{
+    int rc = 0;
+
+#if WITH_PTHREADS
+    pthread_mutex_lock(&r->lock);
+#endif
+    rkey_free(r);
+    if (!rkey_get(r, 0))
+        rc = -1;
+#if WITH_PTHREADS
+    pthread_mutex_unlock(&r->lock);
+#endif
+    return rc;
+}
+
+/* Create a new, randomly keyed stream.
+ */
+int
+randstream_create(randstream_t *rp)
+{
+    randstream_t r;
+
+    if (!(r = malloc(sizeof(struct randstream_struct)))) {
+        errno = ENOMEM;
+        goto error;
+    }
+    memset(r, 0, sizeof(struct randstream_struct));
+#if WITH_PTHREADS
+    pthread_mutex_init(&r->lock, NULL);
+#endif
+    if (randstream_churn(r) < 0) {
+        randstream_destroy(r);
+        goto error;
+    }
+    *rp = r;
+    return 0;
+error:
+    return -1;
+}
+
+void
+randstream_destroy(randstream_t r)
+{
+    if (r) {
+        rkey_free(r);
+#if WITH_PTHREADS
+        pthread_mutex_destroy(&r->lock);
+#endif
+        free(r);
+    }
+}
+
+/* Encrypt successive counter blocks starting at 'c' into 'buf',
+ * advancing 'c' past the blocks consumed.
+ */
+static void
+ctrfill(struct rkey_struct *k, unsigned char *c, unsigned char *buf,
+        int buflen)
+{
+    int i;
+    unsigned char out[PAYLOAD_SZ];
+    int cpylen = PAYLOAD_SZ;
+
+    if (aes_ctr) {
+        aes_ctr(&k->nictx, c, buf, buflen);
+        return;
+    }
+    for (i = 0; i < buflen; i += cpylen) {
+        aes_encrypt(&k->ctx, c, out);
+        add128(c, 1);
+        if (cpylen > buflen - i)
+            cpylen = buflen - i;
+        memcpy(&buf[i], out, cpylen);
+    }
+    assert(i == buflen);
+}
+
+/* Fill 'buf' with bytes ['offset', 'offset' + 'buflen') of the keystream
+ * of 'k', where offset is relative to the start of its interval.
+ */
+static void
+rkey_fill(struct rkey_struct *k, unsigned char *buf, int buflen,
+          off_t offset)
+{
+    unsigned char c[PAYLOAD_SZ];
+    unsigned char out[CHACHA_BLOCK_SZ];
+    int skip = offset % PAYLOAD_SZ;
+    int cpylen;
+
+    if (chacha_fn) {
+        unsigned long long block = k->chblock + offset / CHACHA_BLOCK_SZ;
+
+        skip = offset % CHACHA_BLOCK_SZ;
+        if (skip > 0 && buflen > 0) {
+            chacha_fn(&k->chctx, block++, out, CHACHA_BLOCK_SZ);
+            cpylen = CHACHA_BLOCK_SZ - skip;
+            if (cpylen > buflen)
+                cpylen = buflen;
+            memcpy(buf, &out[skip], cpylen);
+            buf += cpylen;
+            buflen -= cpylen;
+        }
+        if (buflen > 0)
+            chacha_fn(&k->chctx, block, buf, buflen);
+        return;
+    }
+    memcpy(c, k->ctr, PAYLOAD_SZ);
+    add128(c, offset / PAYLOAD_SZ);
+    if (skip > 0 && buflen > 0) {
+        ctrfill(k, c, out, PAYLOAD_SZ);
+        cpylen = PAYLOAD_SZ - skip;
+        if (cpylen > buflen)
+            cpylen = buflen;
+        memcpy(buf, &out[skip], cpylen);
+        buf += cpylen;
+        buflen -= cpylen;
+    }
+    if (buflen > 0)
+        ctrfill(k, c, buf, buflen);
+}
+
+/* Fill 'buf' with bytes ['offset', 'offset' + 'buflen') of the stream.
+ * Safe to call concurrently on the same stream.  Returns 0, or -1 if no
+ * key could be had for the interval.
+ */
+int
+randstream_fill(randstream_t r, unsigned char *buf, int buflen, off_t offset)
+{
+    struct rkey_struct *k;
+    int n, len;
+
+    assert(offset >= 0);
+    while (buflen > 0) {
+        n = offset / RESEED_INTERVAL;
+        len = buflen;
+        if (len > (off_t)(n + 1) * RESEED_INTERVAL - offset)
+            len = (off_t)(n + 1) * RESEED_INTERVAL - offset;
+#if WITH_PTHREADS
+        pthread_mutex_lock(&r->lock);
+#endif
+        k = rkey_get(r, n);
+#if WITH_PTHREADS
+        pthread_mutex_unlock(&r->lock);
+#endif
+        if (!k)
+            return -1;
+        rkey_fill(k, buf, len, offset - (off_t)n * RESEED_INTERVAL);
+        buf += len;
+        buflen -= len;
+        offset += len;
+    }
+    return 0;
+}
+
+#if defined(HAVE_LIBGCRYPT) || defined(HAVE_OPENSSL)
+#define LIBKEY_SZ   32          /* AES-256 */
+
+/* Library AES-CTR keystream: key and initial counter block for the pass.
+ * The library counts big-endian, so the counter for a byte offset is
+ * computed that way too.
+ */
+static unsigned char lib_key[LIBKEY_SZ];
+static unsigned char lib_ctr[PAYLOAD_SZ];
+
+/* Add 'n' to the big-endian 128 bit counter 'val'.
+ */
+static void
+add128_be(unsigned char *val, unsigned long long n)
+{
+    int i;
+    unsigned int sum;
+
+    for (i = PAYLOAD_SZ - 1; i >= 0 && n > 0; i--) {
+        sum = val[i] + (unsigned int)(n & 0xff);
+        val[i] = (unsigned char)sum;
+        n = (n >> 8) + (sum >> 8);
+    }
+}
+
+/* Draw a new key and counter for the library keystream from the
+ * library's own random number generator (or the set_seed() stream).
+ */
+static int
+libctr_churn(void)
+{
+    if (seeded) {
+        if (genseed(lib_key, LIBKEY_SZ) < 0 || genseed(lib_ctr, PAYLOAD_SZ) < 0)
+            return -1;
+        return 0;
+    }
+#if defined(HAVE_LIBGCRYPT)
+    gcry_randomize(lib_key, LIBKEY_SZ, GCRY_STRONG_RANDOM);
+    gcry_randomize(lib_ctr, PAYLOAD_SZ, GCRY_STRONG_RANDOM);
+#elif defined(HAVE_OPENSSL)
+    if (RAND_bytes(lib_key, LIBKEY_SZ) != 1
+            || RAND_bytes(lib_ctr, PAYLOAD_SZ) != 1) {
+        errno = EIO;
+        return -1;
+    }
+#endif /* HAVE_LIBGCRYPT */
+    return 0;
+}
+
+/* Fill 'buf' with bytes ['offset', 'offset' + 'buflen') of the library
+ * keystream by encrypting zeroes in CTR mode.  Each call uses its own
+ * cipher handle so producer threads do not share state; the setup cost
+ * is small next to a refill buffer.  Returns 0, or -1 with errno set to
+ * EIO if the library fails.
+ */
+static int
+libctr_fill(unsigned char *buf, int buflen, off_t offset)
+{
+    unsigned char iv[PAYLOAD_SZ];
+    unsigned char out[PAYLOAD_SZ];
+    int skip = offset % PAYLOAD_SZ;
+    int cpylen;
+#if defined(HAVE_LIBGCRYPT)
+    gcry_cipher_hd_t h;
+
+    memcpy(iv, lib_ctr, PAYLOAD_SZ);
+    add128_be(iv, offset / PAYLOAD_SZ);
+    if (gcry_cipher_open(&h, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CTR, 0))
+        goto fail;
+    if (gcry_cipher_setkey(h, lib_key, LIBKEY_SZ)
+            || gcry_cipher_setctr(h, iv, PAYLOAD_SZ))
+        goto error;
+    if (skip > 0) {
+        memset(out, 0, PAYLOAD_SZ);
+        if (gcry_cipher_encrypt(h, out, PAYLOAD_SZ, NULL, 0))
+            goto error;
+        cpylen = PAYLOAD_SZ - skip;
+        if (cpylen > buflen)
+            cpylen = buflen;
+        memcpy(buf, &out[skip], cpylen);
+        buf += cpylen;
+        buflen -= cpylen;
+    }
+    memset(buf, 0, buflen);
+    if (buflen > 0 && gcry_cipher_encrypt(h, buf, buflen, NULL, 0))
+        goto error;
+    gcry_cipher_close(h);
+    return 0;
+error:
+    gcry_cipher_close(h);
+#elif defined(HAVE_OPENSSL)
+    EVP_CIPHER_CTX *ctx;
+    int outl;
+
+    memcpy(iv, lib_ctr, PAYLOAD_SZ);
+    add128_be(iv, offset / PAYLOAD_SZ);
+    if (!(ctx = EVP_CIPHER_CTX_new()))
+        goto fail;
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, lib_key, iv) != 1)
+        goto error;
+    if (skip > 0) {
+        memset(out, 0, PAYLOAD_SZ);
+        if (EVP_EncryptUpdate(ctx, out, &outl, out, PAYLOAD_SZ) != 1)
+            goto error;
+        cpylen = PAYLOAD_SZ - skip;
+        if (cpylen > buflen)
+            cpylen = buflen;
+        memcpy(buf, &out[skip], cpylen);
+        buf += cpylen;
+        buflen -= cpylen;
+    }
+    memset(buf, 0, buflen);
+    if (buflen > 0 && EVP_EncryptUpdate(ctx, buf, &outl, buf, buflen) != 1)
+        goto error;
+    EVP_CIPHER_CTX_free(ctx);
+    return 0;
+error:
+    EVP_CIPHER_CTX_free(ctx);
+#endif /* HAVE_LIBGCRYPT */
+fail:
+    errno = EIO;
+    return -1;
+}
+#endif /* HAVE_LIBGCRYPT || HAVE_OPENSSL */
+
+/* Pick new (random) key and counter values for genrand().
+ */
+int
+churnrand(void)
+{
+    if (randstream_churn(stream) < 0)
+        return -1;
+#if defined(HAVE_LIBGCRYPT) || defined(HAVE_OPENSSL)
+    if ((rng_cur == RNG_GCRYPT || rng_cur == RNG_OPENSSL)
+            && libctr_churn() < 0)
+        return -1;
+#endif
+    stream_off = 0;
     return 0;
+}
+
+/* Return true if generator 'r' is compiled in and usable on this system.
+ */
+static bool
+rng_usable(rng_t r)
+{
+    switch (r) {
+        case RNG_AES:
+        case RNG_CHACHA:
+            return true;
+        case RNG_AESNI:
+            return aesni_available();
+        case RNG_RDRAND:
+            return !no_hwrand && init_hwrand() != NULL;
+        case RNG_GCRYPT:
+#if defined(HAVE_LIBGCRYPT)
+            return true;
+#else
+            return false;
+#endif
+        case RNG_OPENSSL:
+#if defined(HAVE_OPENSSL)
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+/* Switch genrand() to generator 'r' and rekey the built-in stream,
+ * whose key material depends on the cipher.
+ */
+static int
+rng_setup(rng_t r)
+{
+    aes_ctr = NULL;
+    chacha_fn = NULL;
+    gen_hwrand = NULL;
+    switch (r) {
+        case RNG_AESNI:
+            /* Prefer the widest AES instructions the CPU has */
+            aes_ctr = vaes_available() ? vaes_ctr : aesni_ctr;
+            break;
+        case RNG_CHACHA:
+            chacha_fn = chacha_best(NULL);
+            break;
+        case RNG_RDRAND:
+            gen_hwrand = init_hwrand();
+            break;
+        default:
+            break;
+    }
+    rng_cur = r;
+    if (!stream)
+        return randstream_create(&stream);
+    return churnrand();
+}
+
+static double
+elapsed_usec(struct timeval *t0)
+{
+    struct timeval t1;
+
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0->tv_sec) * 1E6 + (t1.tv_usec - t0->tv_usec);
+}
+
+/* Time each usable generator for a share of PROBE_USEC and switch to
+ * the fastest.  A generator whose output rate depends on the number of
+ * threads asking for it is only measured single threaded.
+ */
+static int
+rng_probe(void)
+{
+    unsigned char *buf;
+    struct timeval t0;
+    double usec, gbps, best_gbps = 0;
+    rng_t r, best = RNG_AES;
+    off_t len;
+    int n = 0;
+
+    if (!(buf = malloc(PROBE_BUFSIZE))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (r = RNG_AUTO + 1; r < RNG_COUNT; r++)
+        if (rng_usable(r))
+            n++;
+    for (r = RNG_AUTO + 1; r < RNG_COUNT; r++) {
+        if (!rng_usable(r))
+            continue;
+        if (rng_setup(r) < 0)
+            goto error;
+        gettimeofday(&t0, NULL);
+        len = 0;
+        do {
+            if (genrand(buf, PROBE_BUFSIZE) < 0)
+                goto error;
+            len += PROBE_BUFSIZE;
+        } while ((usec = elapsed_usec(&t0)) < PROBE_USEC / n);
+        gbps = len / usec / 1E3;
+        if (gbps > best_gbps) {
+            best_gbps = gbps;
+            best = r;
+        }
+    }
+    free(buf);
+    rng_gbps = best_gbps;
+    return rng_setup(best);
 error:
+    free(buf);
     return -1;
 }
-#endif /* !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL) */
 
-/* Initialize the module.
+/* Initialize the module.  With the 'auto' generator, the first call
+ * picks the fastest one by timing them all; later calls only rekey.
  */
 int
 initrand(void)
 {
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
     struct timeval tv;
-#elif defined(HAVE_LIBCRYPT)
+    rng_t r;
+
+#if defined(HAVE_LIBGCRYPT)
     if (!gcry_check_version(GCRYPT_VERSION)) {
         goto error;
     }
     gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
-#endif /* !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL) */
-
-    if (!no_hwrand)
-        gen_hwrand = init_hwrand();
+#endif /* HAVE_LIBGCRYPT */
 
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
     /* Always initialize the software random number generator as backup */
 
     if (gettimeofday(&tv, NULL) < 0)
@@ -164,45 +729,123 @@ initrand(void)
     if (initstate_r(tv.tv_usec, rstate, sizeof(rstate), &rdata) < 0)
         goto error;
 #endif
-    if (churnrand() < 0)
-        goto error;
-#endif /* !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL) */
-    return 0;
+    if (!no_hwrand)
+        gen_hwseed = init_hwseed();
+    r = rng_req;
+    if (r == RNG_AUTO && seeded)
+        r = RNG_CHACHA;     /* the same everywhere, unlike the probe result */
+    if (r == RNG_AUTO) {
+        if (rng_cur == RNG_AUTO)
+            return rng_probe();
+        return churnrand();
+    }
+    if (r != rng_cur) {
+        rng_gbps = 0;
+        return rng_setup(r);
+    }
+    return churnrand();
 error:
     return -1;
 }
 
-/* Fill buf with random data.
+/* Fill buf with random data for byte 'offset' of the current pass.
+ * The built-in and library generators are seekable, so output depends
+ * only on 'offset' and not on call order; the hardware generator
+ * ignores 'offset'.  Safe to call from several threads.  Returns 0, or
+ * -1 with errno set if the generator failed and 'buf' must not be used.
  */
-void
-genrand(unsigned char *buf, int buflen)
+int
+genrand_at(unsigned char *buf, int buflen, off_t offset)
 {
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
-    int i;
-    unsigned char out[PAYLOAD_SZ];
-    int cpylen = PAYLOAD_SZ;
+    switch (rng_cur) {
+        case RNG_RDRAND:
+            if (gen_hwrand && gen_hwrand(buf, buflen))
+                return 0;
+            break;  /* fall back to the software generator */
+#if defined(HAVE_LIBGCRYPT) || defined(HAVE_OPENSSL)
+        case RNG_GCRYPT:
+        case RNG_OPENSSL:
+            return libctr_fill(buf, buflen, offset);
 #endif
-
-    if (gen_hwrand) {
-        bool hwok = gen_hwrand(buf, buflen);
-        if (hwok)
-            return;
+        default:
+            break;
     }
+    return randstream_fill(stream, buf, buflen, offset);
+}
 
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
-    for (i = 0; i < buflen; i += cpylen) {
-        aes_encrypt(&ctx, ctr, out);
-        incr128(ctr);
-        if (cpylen > buflen - i)
-            cpylen = buflen - i;
-        memcpy(&buf[i], out, cpylen);
+/* Fill buf with the next 'buflen' bytes of random data.
+ * Return values are as for genrand_at().
+ */
+int
+genrand(unsigned char *buf, int buflen)
+{
+    if (genrand_at(buf, buflen, stream_off) < 0)
+        return -1;
+    stream_off += buflen;
+    return 0;
+}
+
+/*
+ * Select the generator behind genrand() by name, or "auto" to use the
+ * fastest one.  Takes effect at the next initrand().
+ */
+int
+set_rng(const char *name)
+{
+    rng_t r;
+
+    for (r = RNG_AUTO; r < RNG_COUNT; r++) {
+        if (!strcmp(name, rng_names[r])) {
+            if (r != RNG_AUTO && !rng_usable(r))
+                break;
+            rng_req = r;
+            return 0;
+        }
     }
-    assert(i == buflen);
-#elif defined(HAVE_LIBGCRYPT)
-    gcry_randomize(buf, buflen, GCRY_STRONG_RANDOM);
-#elif defined(HAVE_OPENSSL)
-    assert(RAND_bytes(buf, buflen) == 1);
-#endif /* HAVE_LIBGCRYPT. */
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * Return the name of the generator in use and, if it was picked by the
+ * 'auto' probe, its measured rate in GB/s (else 0).
+ */
+const char *
+rng_info(double *gbps)
+{
+    if (gbps)
+        *gbps = rng_gbps;
+    return rng_names[rng_cur];
+}
+
+/*
+ * Derive all key material from 'seed' instead of the system random
+ * sources, so a run can be repeated exactly.  Unless a generator is
+ * selected with set_rng(), ChaCha20 is used.
+ */
+void
+set_seed(unsigned long long seed)
+{
+    unsigned char key[CHACHA_KEY_SZ];
+    unsigned char nonce[CHACHA_NONCE_SZ] = { 's', 'c', 'r', 'u', 'b', 0, 0, 0 };
+    int i;
+
+    memset(key, 0, sizeof(key));
+    for (i = 0; i < 8; i++)
+        key[i] = (unsigned char)(seed >> (i * 8));
+    chacha_set_key(&seedctx, key, nonce);
+    seed_block = 0;
+    seeded = true;
+}
+
+/*
+ * Return true if genrand_at() output for an offset can be generated
+ * again, e.g. to verify it (false for the hardware generator).
+ */
+bool
+genrand_repeatable(void)
+{
+    return rng_cur != RNG_RDRAND;
 }
 
 /*
@@ -214,6 +857,16 @@ disable_hwrand(void)
     no_hwrand = true;
 }
 
+/*
+ * Fill random passes directly from the hardware random number generator
+ * instead of only using it to seed the software generator
+ */
+void
+enable_raw_hwrand(void)
+{
+    rng_req = RNG_RDRAND;
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
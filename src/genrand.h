@@ -12,12 +12,24 @@
 #include "config.h"
 
 void disable_hwrand(void);
+void enable_raw_hwrand(void);
+int set_rng(const char *name);
+const char *rng_info(double *gbps);
+void set_seed(unsigned long long seed);
+bool genrand_repeatable(void);
 int initrand(void);
-void genrand(unsigned char *buf, int buflen);
+int genrand(unsigned char *buf, int buflen);
+int genrand_at(unsigned char *buf, int buflen, off_t offset);
 
-#ifndef HAVE_LIBGCRYPT
 int churnrand(void);
-#endif /* HAVE_LIBGCRYPT. */
+
+typedef struct randstream_struct *randstream_t;
+
+int  randstream_create(randstream_t *rp);
+void randstream_destroy(randstream_t r);
+int  randstream_churn(randstream_t r);
+int  randstream_fill(randstream_t r, unsigned char *buf, int buflen,
+                     off_t offset);
 
 
 /*
@@ -42,6 +42,9 @@
 #if HAVE_SYS_SCSI_H
 #include <sys/scsi.h>
 #endif
+#if HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
 
 #include "getsize.h"
 
@@ -270,6 +273,115 @@ getsize(char *path, off_t *sizep)
 }
 #endif
 
+#if defined(__linux__)
+/* Read the integer sysfs queue attribute 'name' of block device 'sb'.
+ */
+static int
+queue_attr(struct stat *sb, const char *name, int *valp)
+{
+    char sysfs[80];
+    FILE *fp;
+    int val;
+
+    snprintf(sysfs, sizeof(sysfs), "/sys/dev/block/%u:%u/queue/%s",
+             major(sb->st_rdev), minor(sb->st_rdev), name);
+    if (!(fp = fopen(sysfs, "r"))) {
+        /* a partition shares the queue of its parent disk */
+        snprintf(sysfs, sizeof(sysfs), "/sys/dev/block/%u:%u/../queue/%s",
+                 major(sb->st_rdev), minor(sb->st_rdev), name);
+        if (!(fp = fopen(sysfs, "r")))
+            return -1;
+    }
+    if (fscanf(fp, "%d", &val) != 1) {
+        (void)fclose(fp);
+        errno = EINVAL;
+        return -1;
+    }
+    (void)fclose(fp);
+    *valp = val;
+    return 0;
+}
+
+/* Set '*rotp' to 1 if the block device 'path' is rotational (a spinning
+ * disk) or 0 if not (SSD, NVMe), as the kernel reports in sysfs.
+ */
+int
+getrotational(char *path, int *rotp)
+{
+    struct stat sb;
+
+    if (stat(path, &sb) < 0)
+        return -1;
+    if (!S_ISBLK(sb.st_mode)) {
+        errno = ENOTBLK;
+        return -1;
+    }
+    return queue_attr(&sb, "rotational", rotp);
+}
+
+#if defined(BLKSSZGET) && defined(BLKPBSZGET) && defined(BLKIOMIN) \
+        && defined(BLKIOOPT)
+/* Fill in the I/O limits of block device 'path'.  Limits the kernel
+ * does not report are left zero.
+ */
+int
+gettopology(char *path, topology_t *tp)
+{
+    struct stat sb;
+    unsigned int val;
+    int fd = -1;
+
+    memset(tp, 0, sizeof(topology_t));
+    if ((fd = open(path, O_RDONLY)) < 0)
+        goto error;
+    if (fstat(fd, &sb) < 0)
+        goto error;
+    if (!S_ISBLK(sb.st_mode)) {
+        errno = ENOTBLK;
+        goto error;
+    }
+    if (ioctl(fd, BLKSSZGET, &tp->logical) < 0)
+        goto error;
+    if (ioctl(fd, BLKPBSZGET, &val) == 0)
+        tp->physical = val;
+    if (ioctl(fd, BLKIOMIN, &val) == 0)
+        tp->io_min = val;
+    if (ioctl(fd, BLKIOOPT, &val) == 0)
+        tp->io_opt = val;
+    if (queue_attr(&sb, "max_sectors_kb", &tp->max_io) == 0)
+        tp->max_io *= 1024;
+    else
+        tp->max_io = 0;
+    if (close(fd) < 0)
+        goto error;
+    return 0;
+error:
+    if (fd != -1)
+        (void)close(fd);
+    return -1;
+}
+#endif
+#else
+int
+getrotational(char *path, int *rotp)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+#if !defined(__linux__) || !defined(BLKSSZGET) || !defined(BLKPBSZGET) \
+        || !defined(BLKIOMIN) || !defined(BLKIOOPT)
+/* Unimplemented!  Scrub uses its default block size.
+ */
+int
+gettopology(char *path, topology_t *tp)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
 void
 size2str(char *str, int len, off_t size)
 {
@@ -369,6 +481,22 @@ str2int(char *str)
     return (int)val;
 }
 
+/* Parse a plain decimal count between 1 and 'max', without the size
+ * suffixes str2int() takes.  Return 0 if 'str' is not one.
+ */
+int
+str2count(char *str, int max)
+{
+    char *end;
+    long val;
+
+    errno = 0;
+    val = strtol(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || val < 1 || val > max)
+        return 0;
+    return (int)val;
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
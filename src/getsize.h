@@ -9,9 +9,22 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
 \************************************************************/
 
+/* Block device I/O limits in bytes, zero if not reported.
+ */
+typedef struct {
+    int logical;        /* logical sector size */
+    int physical;       /* physical sector size */
+    int io_min;         /* minimum efficient I/O size */
+    int io_opt;         /* optimal I/O size, e.g. RAID stripe width */
+    int max_io;         /* largest request passed to the device unsplit */
+} topology_t;
+
 int getsize(char *path, off_t *sizep);
+int getrotational(char *path, int *rotp);
+int gettopology(char *path, topology_t *tp);
 off_t str2size(char *str);
 int str2int(char *str);
+int str2count(char *str, int max);
 void size2str(char *str, int len, off_t size);
 
 /*
@@ -27,6 +27,9 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "util.h"
 #include "hwrand.h"
@@ -93,12 +96,14 @@ static void cpuid(unsigned int leaf, unsigned int subleaf, struct cpuid *out)
 #endif
 }
 
-/* Open-code the RDRAND instruction to support older assemblers */
+/* Open-code the RDRAND and RDSEED instructions to support older assemblers */
 #ifdef __x86_64__
 # define RDRAND ".byte 0x48,0x0f,0xc7,0xf0" /* rdrand %rax */
+# define RDSEED ".byte 0x48,0x0f,0xc7,0xf8" /* rdseed %rax */
 typedef unsigned long long rdrand_t;
 #else
 # define RDRAND ".byte 0x0f,0xc7,0xf0"      /* rdrand %eax */
+# define RDSEED ".byte 0x0f,0xc7,0xf8"      /* rdseed %eax */
 typedef unsigned int rdrand_t;
 #endif
 
@@ -117,12 +122,32 @@ static inline bool rdrand(rdrand_t *ptr)
     return ctr > 0;
 }
 
-static bool hwrand_rdrand(unsigned char *buf, int bufsize)
+/* RDSEED draws straight from the entropy source and runs dry much more
+ * easily than RDRAND, so back off and retry for longer.
+ */
+static inline bool rdseed(rdrand_t *ptr)
+{
+    unsigned int ctr = 1000;    /* Maximum number of rdseed attempts */
+
+    asm volatile("1:\n"
+                 " " RDSEED "\n"
+                 " jc 2f\n"
+                 " pause\n"
+                 " dec %1\n"
+                 " jnz 1b\n"
+                 "2:"
+                 : "=a" (*ptr), "+r" (ctr));
+
+    return ctr > 0;
+}
+
+static bool hwrand_fill(unsigned char *buf, int bufsize,
+                        bool (*insn)(rdrand_t *))
 {
     rdrand_t tmp;
 
     while (bufsize >= sizeof(rdrand_t)) {
-        if (!rdrand((rdrand_t *)buf))
+        if (!insn((rdrand_t *)buf))
             return false;
 
         buf     += sizeof(rdrand_t);
@@ -132,7 +157,7 @@ static bool hwrand_rdrand(unsigned char *buf, int bufsize)
     if (!bufsize)
         return true;
 
-    if (!rdrand(&tmp))
+    if (!insn(&tmp))
         return false;
 
 #ifdef __x86_64__
@@ -155,6 +180,89 @@ static bool hwrand_rdrand(unsigned char *buf, int bufsize)
     return true;
 }
 
+static bool hwrand_rdrand(unsigned char *buf, int bufsize)
+{
+    return hwrand_fill(buf, bufsize, rdrand);
+}
+
+static bool hwrand_rdseed(unsigned char *buf, int bufsize)
+{
+    return hwrand_fill(buf, bufsize, rdseed);
+}
+
+/* Open-code XGETBV to support older assemblers */
+#define XGETBV ".byte 0x0f,0x01,0xd0"       /* xgetbv */
+
+static unsigned long long xgetbv(unsigned int index)
+{
+    unsigned int eax, edx;
+
+    asm volatile(XGETBV : "=a" (eax), "=d" (edx) : "c" (index));
+
+    return ((unsigned long long)edx << 32) | eax;
+}
+
+#define XCR0_AVX        0x06    /* XMM and YMM state */
+#define XCR0_AVX512     0xe6    /* ... plus opmask and ZMM state */
+
+static unsigned int caps = 0;
+
+static void hwcaps_probe(void)
+{
+    struct cpuid cpu;
+    unsigned int maxleaf;
+    unsigned long long xcr0 = 0;
+
+    if (!have_cpuid())
+        return;
+
+    cpuid(0, 0, &cpu);
+    maxleaf = cpu.eax;
+    if (maxleaf < 1)
+        return;
+
+    cpuid(1, 0, &cpu);
+    if (cpu.ecx & (1 << 25))
+        caps |= HWCAP_AESNI;
+    if (cpu.edx & (1 << 26))
+        caps |= HWCAP_SSE2;
+    if (cpu.ecx & (1 << 27))    /* OSXSAVE */
+        xcr0 = xgetbv(0);
+
+    if (maxleaf >= 7) {
+        cpuid(7, 0, &cpu);
+        if (cpu.ebx & (1 << 18))
+            caps |= HWCAP_RDSEED;
+        if ((xcr0 & XCR0_AVX) == XCR0_AVX && (cpu.ebx & (1 << 5)))
+            caps |= HWCAP_AVX2;
+        if ((xcr0 & XCR0_AVX512) == XCR0_AVX512 && (cpu.ebx & (1 << 16))) {
+            caps |= HWCAP_AVX512;
+            if (cpu.ecx & (1 << 9))
+                caps |= HWCAP_VAES; /* AVX512F + VAES */
+        }
+    }
+}
+
+/* Probe the CPU once, so that threads asking at the same time all see
+ * the finished mask.
+ */
+unsigned int hwcaps(void)
+{
+#if WITH_PTHREADS
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, hwcaps_probe);
+#else
+    static int done = 0;
+
+    if (!done) {
+        hwcaps_probe();
+        done = 1;
+    }
+#endif
+    return caps;
+}
+
 hwrand_t init_hwrand(void)
 {
     struct cpuid cpu;
@@ -173,6 +281,17 @@ hwrand_t init_hwrand(void)
     return hwrand_rdrand;
 }
 
+/* Return a generator suited to seeding a software generator: RDSEED if
+ * the CPU has it, else RDRAND.
+ */
+hwrand_t init_hwseed(void)
+{
+    if (hwcaps() & HWCAP_RDSEED)
+        return hwrand_rdseed;
+
+    return init_hwrand();
+}
+
 #else /* Not __GNUC__ or not x86 */
 
 hwrand_t init_hwrand(void)
@@ -180,6 +299,16 @@ hwrand_t init_hwrand(void)
     return NULL;
 }
 
+hwrand_t init_hwseed(void)
+{
+    return NULL;
+}
+
+unsigned int hwcaps(void)
+{
+    return 0;
+}
+
 #endif
 
 /*
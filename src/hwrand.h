@@ -12,6 +12,16 @@
 typedef bool (*hwrand_t)(unsigned char *, int);
 
 hwrand_t init_hwrand(void);
+hwrand_t init_hwseed(void);
+
+#define HWCAP_AESNI     0x0001  /* AES-NI instructions */
+#define HWCAP_VAES      0x0002  /* VAES on 512-bit vectors (AVX-512F) */
+#define HWCAP_RDSEED    0x0004  /* RDSEED instruction */
+#define HWCAP_SSE2      0x0008  /* SSE2 instructions */
+#define HWCAP_AVX2      0x0010  /* AVX2 on 256-bit vectors */
+#define HWCAP_AVX512    0x0020  /* AVX-512F on 512-bit vectors */
+
+unsigned int hwcaps(void);
 
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
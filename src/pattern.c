@@ -17,8 +17,23 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if HAVE_SSE2 || HAVE_AVX2 || HAVE_AVX512
+#include <immintrin.h>
+#endif
 
+#include "util.h"
 #include "pattern.h"
+#include "hwrand.h"
+
+#define PAT_MAXMAPS 1024    /* cap on aliased tiles in a pattern buffer */
 
 extern char *prog;
 
@@ -358,6 +373,133 @@ seq_lookup(char *key)
     return seq;
 }
 
+/* Return true if 'sp' has a random pass.
+ */
+bool
+seq_random(const sequence_t *sp)
+{
+    int i;
+
+    for (i = 0; i < sp->len; i++)
+        if (sp->pat[i].ptype == PAT_RANDOM)
+            return true;
+    return false;
+}
+
+#if HAVE_SYS_MMAN_H && defined(MAP_ANONYMOUS)
+/* Return the size of the tile a pattern buffer of 'n' bytes is built
+ * from: whole pages, a whole number of pattern periods, and large enough
+ * that the buffer takes no more than PAT_MAXMAPS mappings.
+ */
+static size_t
+pat_tile(pattern_t p, int n)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t tile = page;
+
+    while (tile % p.len != 0)
+        tile += page;
+    while (n / tile > PAT_MAXMAPS)
+        tile *= 2;
+    return tile;
+}
+
+#if HAVE_MEMFD_CREATE
+/* Fill 'size' bytes at 'buf' with pattern 'p' by mapping one memfd tile
+ * of 'tile' bytes over and over, so the whole buffer costs one tile of
+ * memory.  On failure, 'buf' is left as anonymous memory.
+ */
+static int
+pat_alias(unsigned char *buf, size_t size, size_t tile, pattern_t p)
+{
+    size_t off;
+    int fd;
+
+    if ((fd = memfd_create("scrub-pattern", MFD_CLOEXEC)) < 0)
+        return -1;
+    if (ftruncate(fd, tile) < 0)
+        goto error;
+    for (off = 0; off < size; off += tile) {
+        if (mmap(buf + off, tile, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            goto error;
+    }
+    memset_pat(buf, p, tile);
+    (void)close(fd);
+    return 0;
+error:
+    (void)mmap(buf, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    (void)close(fd);
+    return -1;
+}
+#endif
+
+/* Return a read-only (by convention) buffer of 'n' bytes holding
+ * pattern 'p', for fixed pattern passes.  Where memfd_create() is
+ * available, every tile of the buffer maps the same few pages, so a
+ * large block size costs about a page of memory and the pattern stays
+ * in cache.  Free with free_pattern().
+ */
+unsigned char *
+alloc_pattern(pattern_t p, int n)
+{
+    size_t tile = pat_tile(p, n);
+    size_t size = (n + tile - 1) / tile * tile;
+    unsigned char *buf;
+
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        return NULL;
+#if HAVE_MEMFD_CREATE
+    if (pat_alias(buf, size, tile, p) == 0)
+        return buf;
+#endif
+    memset_pat(buf, p, n);
+    return buf;
+}
+
+void
+free_pattern(unsigned char *buf, pattern_t p, int n)
+{
+    size_t tile = pat_tile(p, n);
+
+    (void)munmap(buf, (n + tile - 1) / tile * tile);
+}
+#else
+unsigned char *
+alloc_pattern(pattern_t p, int n)
+{
+    unsigned char *buf = alloc_buffer(n);
+
+    if (buf)
+        memset_pat(buf, p, n);
+    return buf;
+}
+
+void
+free_pattern(unsigned char *buf, pattern_t p, int n)
+{
+    free(buf);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Return true if 'p' is a fixed pattern of all zero bytes.
+ */
+bool
+pat_zero(pattern_t p)
+{
+    int i;
+
+    if (p.ptype == PAT_RANDOM)
+        return false;
+    for (i = 0; i < p.len; i++)
+        if (p.pat[i] != 0)
+            return false;
+    return true;
+}
+
 const sequence_t *
 seq_lookup_byindex (int i)
 {
@@ -365,16 +507,414 @@ seq_lookup_byindex (int i)
     return sequences[i];
 }
 
-void
-memset_pat(void *s, pattern_t p, size_t n)
+/* Fill and compare kernels.  The SIMD kernels handle the bulk of the
+ * buffer with aligned vector loads or stores.  A pattern of length 'len'
+ * repeats every len / gcd(len, width) vectors (at most 15 for
+ * MAXPATBYTES 16), so that many vectors are built once, starting at the
+ * pattern phase of the first aligned byte, and used round and round.
+ * Fills of PAT_NTSTORE bytes or more use non-temporal stores so a big
+ * fill doesn't flush the cache.
+ */
+#define PAT_NTSTORE (8*1024*1024)
+
+static void
+memset_pat_ref(void *s, pattern_t p, size_t n)
 {
-    int i;
-    char *sp = (char *)s;
+    size_t i;
+    unsigned char *sp = (unsigned char *)s;
 
     for (i = 0; i < n; i++)
         sp[i] = p.pat[i % p.len];
 }
 
+/* Compare 'n' bytes at 's' with pattern 'p', starting at pattern byte
+ * 'phase'.  Return the number of bytes that differ, and if there are
+ * any, put the index of the first in '*firstp'.
+ */
+static size_t
+memcmp_pat_ref(const void *s, pattern_t p, size_t phase, size_t n,
+               size_t *firstp)
+{
+    const unsigned char *sp = s;
+    size_t i, bad = 0;
+
+    for (i = 0; i < n; i++) {
+        if (sp[i] != (unsigned char)p.pat[(phase + i) % p.len]) {
+            if (bad++ == 0)
+                *firstp = i;
+        }
+    }
+    return bad;
+}
+
+#if HAVE_SSE2 || HAVE_AVX2 || HAVE_AVX512
+/* Return the number of bytes before the first 'width' aligned byte of
+ * 's', at most 'n'.
+ */
+static size_t
+pat_head(const void *s, size_t n, int width)
+{
+    size_t head = (width - ((unsigned long)s & (width - 1))) & (width - 1);
+
+    return head > n ? n : head;
+}
+
+/* Put the pattern, starting at pattern byte 'phase', in 'period' for
+ * a kernel of 'width' byte vectors.  Return the number of vectors in
+ * one period.
+ */
+static int
+pat_vectors(pattern_t p, size_t phase, int width, unsigned char *period)
+{
+    int i, nvec, a = p.len, b = width;
+
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    nvec = p.len / a;
+    for (i = 0; i < nvec * width; i++)
+        period[i] = p.pat[(phase + i) % p.len];
+    return nvec;
+}
+
+/* Compare the tail of a buffer after the vector loop and merge the
+ * result into the running count 'bad' and first mismatch '*firstp'.
+ */
+static size_t
+pat_cmp_tail(const unsigned char *s, pattern_t p, size_t phase,
+             size_t off, size_t n, size_t bad, size_t *firstp)
+{
+    size_t first = 0, tbad;
+
+    if ((tbad = memcmp_pat_ref(s + off, p, phase + off, n - off, &first))) {
+        if (bad == 0)
+            *firstp = off + first;
+    }
+    return bad + tbad;
+}
+#endif
+
+#if HAVE_SSE2
+__attribute__((target("sse2"))) static void
+memset_pat_sse2(void *s, pattern_t p, size_t n)
+{
+    unsigned char period[MAXPATBYTES * 16], *sp = s;
+    __m128i v[MAXPATBYTES];
+    size_t step;
+    int i, nvec;
+
+    i = pat_head(sp, n, 16);
+    memset_pat_ref(sp, p, i);
+    nvec = pat_vectors(p, i, 16, period);
+    sp += i;
+    n -= i;
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm_loadu_si128((__m128i *)(period + i * 16));
+    step = nvec * 16;
+    if (n >= PAT_NTSTORE) {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm_stream_si128((__m128i *)(sp + i * 16), v[i]);
+        _mm_sfence();
+    } else if (nvec == 1) {
+        for (; n >= 16; sp += 16, n -= 16)
+            _mm_store_si128((__m128i *)sp, v[0]);
+    } else {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm_store_si128((__m128i *)(sp + i * 16), v[i]);
+    }
+    memcpy(sp, period, n);  /* whole periods were stored: same phase */
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__((target("avx2"))) static void
+memset_pat_avx2(void *s, pattern_t p, size_t n)
+{
+    unsigned char period[MAXPATBYTES * 32], *sp = s;
+    __m256i v[MAXPATBYTES];
+    size_t step;
+    int i, nvec;
+
+    i = pat_head(sp, n, 32);
+    memset_pat_ref(sp, p, i);
+    nvec = pat_vectors(p, i, 32, period);
+    sp += i;
+    n -= i;
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm256_loadu_si256((__m256i *)(period + i * 32));
+    step = nvec * 32;
+    if (n >= PAT_NTSTORE) {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm256_stream_si256((__m256i *)(sp + i * 32), v[i]);
+        _mm_sfence();
+    } else if (nvec == 1) {
+        for (; n >= 32; sp += 32, n -= 32)
+            _mm256_store_si256((__m256i *)sp, v[0]);
+    } else {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm256_store_si256((__m256i *)(sp + i * 32), v[i]);
+    }
+    memcpy(sp, period, n);
+}
+#endif
+
+#if HAVE_AVX512
+__attribute__((target("avx512f"))) static void
+memset_pat_avx512(void *s, pattern_t p, size_t n)
+{
+    unsigned char period[MAXPATBYTES * 64], *sp = s;
+    __m512i v[MAXPATBYTES];
+    size_t step;
+    int i, nvec;
+
+    i = pat_head(sp, n, 64);
+    memset_pat_ref(sp, p, i);
+    nvec = pat_vectors(p, i, 64, period);
+    sp += i;
+    n -= i;
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm512_loadu_si512(period + i * 64);
+    step = nvec * 64;
+    if (n >= PAT_NTSTORE) {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm512_stream_si512((__m512i *)(sp + i * 64), v[i]);
+        _mm_sfence();
+    } else if (nvec == 1) {
+        for (; n >= 64; sp += 64, n -= 64)
+            _mm512_store_si512(sp, v[0]);
+    } else {
+        for (; n >= step; sp += step, n -= step)
+            for (i = 0; i < nvec; i++)
+                _mm512_store_si512(sp + i * 64, v[i]);
+    }
+    memcpy(sp, period, n);
+}
+#endif
+
+#if HAVE_SSE2
+__attribute__((target("sse2"))) static size_t
+memcmp_pat_sse2(const void *s, pattern_t p, size_t phase, size_t n,
+                size_t *firstp)
+{
+    const unsigned char *sp = s;
+    unsigned char period[MAXPATBYTES * 16];
+    __m128i v[MAXPATBYTES];
+    size_t off, bad, step;
+    unsigned int m;
+    int i, nvec;
+
+    off = pat_head(sp, n, 16);
+    bad = memcmp_pat_ref(sp, p, phase, off, firstp);
+    nvec = pat_vectors(p, phase + off, 16, period);
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm_loadu_si128((__m128i *)(period + i * 16));
+    step = nvec * 16;
+    for (; n - off >= step; off += step) {
+        for (i = 0; i < nvec; i++) {
+            m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_load_si128((__m128i *)(sp + off + i * 16)), v[i]));
+            if (m != 0xffff) {
+                m = ~m & 0xffff;
+                if (bad == 0)
+                    *firstp = off + i * 16 + __builtin_ctz(m);
+                bad += __builtin_popcount(m);
+            }
+        }
+    }
+    return pat_cmp_tail(sp, p, phase, off, n, bad, firstp);
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__((target("avx2"))) static size_t
+memcmp_pat_avx2(const void *s, pattern_t p, size_t phase, size_t n,
+                size_t *firstp)
+{
+    const unsigned char *sp = s;
+    unsigned char period[MAXPATBYTES * 32];
+    __m256i v[MAXPATBYTES];
+    size_t off, bad, step;
+    unsigned int m;
+    int i, nvec;
+
+    off = pat_head(sp, n, 32);
+    bad = memcmp_pat_ref(sp, p, phase, off, firstp);
+    nvec = pat_vectors(p, phase + off, 32, period);
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm256_loadu_si256((__m256i *)(period + i * 32));
+    step = nvec * 32;
+    for (; n - off >= step; off += step) {
+        for (i = 0; i < nvec; i++) {
+            m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                    _mm256_load_si256((__m256i *)(sp + off + i * 32)), v[i]));
+            if (m != 0xffffffff) {
+                m = ~m;
+                if (bad == 0)
+                    *firstp = off + i * 32 + __builtin_ctz(m);
+                bad += __builtin_popcount(m);
+            }
+        }
+    }
+    return pat_cmp_tail(sp, p, phase, off, n, bad, firstp);
+}
+#endif
+
+#if HAVE_AVX512
+/* AVX-512F has no byte compare, so vectors are compared a word at a time
+ * and any vector that differs is counted byte by byte.
+ */
+__attribute__((target("avx512f"))) static size_t
+memcmp_pat_avx512(const void *s, pattern_t p, size_t phase, size_t n,
+                  size_t *firstp)
+{
+    const unsigned char *sp = s;
+    unsigned char period[MAXPATBYTES * 64];
+    __m512i v[MAXPATBYTES];
+    size_t off, bad, step, first = 0, vbad;
+    int i, nvec;
+
+    off = pat_head(sp, n, 64);
+    bad = memcmp_pat_ref(sp, p, phase, off, firstp);
+    nvec = pat_vectors(p, phase + off, 64, period);
+    for (i = 0; i < nvec; i++)
+        v[i] = _mm512_loadu_si512(period + i * 64);
+    step = nvec * 64;
+    for (; n - off >= step; off += step) {
+        for (i = 0; i < nvec; i++) {
+            if (_mm512_cmpneq_epi32_mask(_mm512_load_si512(sp + off + i * 64),
+                                         v[i]) == 0)
+                continue;
+            vbad = memcmp_pat_ref(sp + off + i * 64, p, phase + off + i * 64,
+                                  64, &first);
+            if (bad == 0)
+                *firstp = off + i * 64 + first;
+            bad += vbad;
+        }
+    }
+    return pat_cmp_tail(sp, p, phase, off, n, bad, firstp);
+}
+#endif
+
+/* Look up a fill kernel by name, if this build and CPU can run it.
+ */
+patfn_t
+pat_lookup(const char *name)
+{
+    if (!strcmp(name, "ref"))
+        return memset_pat_ref;
+#if HAVE_AVX512
+    if (!strcmp(name, "avx512") && (hwcaps() & HWCAP_AVX512))
+        return memset_pat_avx512;
+#endif
+#if HAVE_AVX2
+    if (!strcmp(name, "avx2") && (hwcaps() & HWCAP_AVX2))
+        return memset_pat_avx2;
+#endif
+#if HAVE_SSE2
+    if (!strcmp(name, "sse2") && (hwcaps() & HWCAP_SSE2))
+        return memset_pat_sse2;
+#endif
+    return NULL;
+}
+
+/* Look up a compare kernel by name, if this build and CPU can run it.
+ */
+patcmpfn_t
+patcmp_lookup(const char *name)
+{
+    if (!strcmp(name, "ref"))
+        return memcmp_pat_ref;
+#if HAVE_AVX512
+    if (!strcmp(name, "avx512") && (hwcaps() & HWCAP_AVX512))
+        return memcmp_pat_avx512;
+#endif
+#if HAVE_AVX2
+    if (!strcmp(name, "avx2") && (hwcaps() & HWCAP_AVX2))
+        return memcmp_pat_avx2;
+#endif
+#if HAVE_SSE2
+    if (!strcmp(name, "sse2") && (hwcaps() & HWCAP_SSE2))
+        return memcmp_pat_sse2;
+#endif
+    return NULL;
+}
+
+static const char *pat_kernels[] = { "avx512", "avx2", "sse2", "ref", NULL };
+
+/* Return the fastest fill kernel this build and CPU can run.
+ */
+patfn_t
+pat_best(const char **namep)
+{
+    patfn_t fn = NULL;
+    int i;
+
+    for (i = 0; pat_kernels[i] != NULL; i++) {
+        if ((fn = pat_lookup(pat_kernels[i]))) {
+            if (namep)
+                *namep = pat_kernels[i];
+            break;
+        }
+    }
+    return fn;
+}
+
+static patfn_t pat_fill = NULL;
+static patcmpfn_t pat_cmp = NULL;
+
+static void
+pat_choose(void)
+{
+    int i;
+
+    pat_fill = pat_best(NULL);
+    for (i = 0; !pat_cmp && pat_kernels[i] != NULL; i++)
+        pat_cmp = patcmp_lookup(pat_kernels[i]);
+}
+
+/* Pick the fill and compare kernels exactly once, even when the first
+ * calls arrive from several fill threads at the same time.
+ */
+static void
+pat_init(void)
+{
+#if WITH_PTHREADS
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, pat_choose);
+#else
+    if (!pat_fill)
+        pat_choose();
+#endif
+}
+
+void
+memset_pat(void *s, pattern_t p, size_t n)
+{
+    pat_init();
+    pat_fill(s, p, n);
+}
+
+/* Compare 'n' bytes at 's' with pattern 'p' starting at pattern byte
+ * 'phase', using the fastest compare kernel.  Return the number of
+ * bytes that differ; if any do, the index of the first is put in
+ * '*firstp'.
+ */
+size_t
+memcmp_pat(const void *s, pattern_t p, size_t phase, size_t n,
+           size_t *firstp)
+{
+    pat_init();
+    return pat_cmp(s, p, phase, n, firstp);
+}
+
 char *
 pat2str(pattern_t p)
 {
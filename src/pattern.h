@@ -31,14 +31,34 @@ typedef struct {
     pattern_t   pat[MAXSEQPATTERNS];
 } sequence_t;
 
+/* Fill 'n' bytes at 's' with pattern 'p', starting at pattern byte 0.
+ */
+typedef void (*patfn_t)(void *s, pattern_t p, size_t n);
+
+/* Compare 'n' bytes at 's' with pattern 'p' starting at pattern byte
+ * 'phase'.  Return the number of bytes that differ, putting the index
+ * of the first in '*firstp'.
+ */
+typedef size_t (*patcmpfn_t)(const void *s, pattern_t p, size_t phase,
+                             size_t n, size_t *firstp);
+
 const sequence_t *seq_lookup(char *name);
 void              seq_list(FILE *fp);
 char             *pat2str(pattern_t p);
+bool              pat_zero(pattern_t p);
 void              memset_pat(void *s, pattern_t p, size_t n);
+patfn_t           pat_lookup(const char *name);
+patfn_t           pat_best(const char **namep);
+size_t            memcmp_pat(const void *s, pattern_t p, size_t phase,
+                             size_t n, size_t *firstp);
+patcmpfn_t        patcmp_lookup(const char *name);
+unsigned char    *alloc_pattern(pattern_t p, int n);
+void              free_pattern(unsigned char *buf, pattern_t p, int n);
 
 const sequence_t *seq_lookup_byindex(int i);
 const int         seq_count(void);
 void              seq2str(const sequence_t *sp, char *buf, int len);
+bool              seq_random(const sequence_t *sp);
 
 sequence_t *seq_create (char *key, char *desc, char *s);
 void seq_destroy (sequence_t *sp);
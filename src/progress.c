@@ -68,6 +68,33 @@ progress_destroy(prog_t ctx)
     }
 }
 
+/* Start the bar over at zero, for a pass that is restarted by another
+ * method.  A terminal bar is erased in place; a batch bar can't be, so
+ * its line is ended and a new one begun with 'label'.
+ */
+void
+progress_reset(prog_t ctx, const char *label)
+{
+    int i;
+
+    if (ctx) {
+        assert(ctx->magic == PROGRESS_MAGIC);
+        if (ctx->bars == 0)
+            return;
+        if (ctx->batch)
+            printf("|\n%s|", label);
+        else {
+            for (i = 0; i < ctx->bars; i++)
+                printf("\b");
+            printf("%*s", ctx->bars, "");
+            for (i = 0; i < ctx->bars; i++)
+                printf("\b");
+        }
+        fflush(stdout);
+        ctx->bars = 0;
+    }
+}
+
 void
 progress_update(prog_t ctx, double complete)
 {
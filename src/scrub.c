@@ -33,14 +33,17 @@
 
 #include "util.h"
 #include "genrand.h"
+#include "pattern.h"
 #include "fillfile.h"
 #include "filldentry.h"
 #include "getsize.h"
 #include "progress.h"
 #include "sig.h"
-#include "pattern.h"
 
 #define BUFSIZE (4*1024*1024) /* default blocksize */
+#define MAX_THREADS     256     /* --threads limit */
+#define MAX_RING_DEPTH  256     /* --ring-depth limit */
+#define MAX_STREAMS     256     /* --streams limit */
 
 struct opt_struct {
     const sequence_t *seq;
@@ -53,11 +56,29 @@ struct opt_struct {
     bool sparse;
     bool nofollow;
     bool nohwrand;
+    bool rawhwrand;
     bool nothreads;
+    int threads;
+    int ringdepth;
+    bool verbose;
+    bool fanout;
+    char *io;
+    int iodepth;
+    int streams;
+    int wavefront;
+    bool zeroout;
+    bool dsync;
+    char *rng;
+    bool verifyrandom;
+    bool verifybehind;
+    bool seeded;
+    unsigned long long seed;
 };
 
 static bool       scrub(char *path, off_t size, const sequence_t *seq,
-                      int bufsize, bool nosig, bool sparse, bool enospc);
+                      int bufsize, bool nosig, bool sparse, bool enospc,
+                      bool vrandom, bool zeroout, bool vbehind,
+                      int wavefront);
 static void       scrub_free(char *path, const struct opt_struct *opt);
 static void       scrub_dirent(char *path, const struct opt_struct *opt);
 static void       scrub_file(char *path, const struct opt_struct *opt);
@@ -65,12 +86,37 @@ static void       scrub_file(char *path, const struct opt_struct *opt);
 static void       scrub_resfork(char *path, const struct opt_struct *opt);
 #endif
 static void       scrub_disk(char *path, const struct opt_struct *opt);
+static void       scrub_fanout(char **paths, int count,
+                               const struct opt_struct *opt);
 static int        scrub_object(char *path, const struct opt_struct *opt,
                                bool noexec, bool dryrun);
+static int        io_blocksize(char *path, const struct opt_struct *opt,
+                               int *alignp);
+static void       verify_error(char *path, off_t offset, size_t mismatch);
 
 #define OPTIONS "p:D:Xb:s:fSrvTLRthn"
 #if HAVE_GETOPT_LONG
 #define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+
+/* Options with no short equivalent */
+enum {
+    OPT_THREADS = 256,
+    OPT_RING_DEPTH,
+    OPT_RAW_HWRAND,
+    OPT_RNG,
+    OPT_VERIFY_RANDOM,
+    OPT_VERIFY_BEHIND,
+    OPT_SEED,
+    OPT_VERBOSE,
+    OPT_FAN_OUT,
+    OPT_IO,
+    OPT_QUEUE_DEPTH,
+    OPT_STREAMS,
+    OPT_WAVEFRONT,
+    OPT_ZEROOUT,
+    OPT_DSYNC,
+};
+
 static struct option longopts[] = {
     {"pattern",          required_argument,  0, 'p'},
     {"dirent",           required_argument,  0, 'D'},
@@ -84,7 +130,22 @@ static struct option longopts[] = {
     {"test-sparse",      no_argument,        0, 'T'},
     {"no-link",          no_argument,        0, 'L'},
     {"no-hwrand",        no_argument,        0, 'R'},
+    {"raw-hwrand",       no_argument,        0, OPT_RAW_HWRAND},
+    {"rng",              required_argument,  0, OPT_RNG},
+    {"verify-random",    no_argument,        0, OPT_VERIFY_RANDOM},
+    {"verify-behind",    no_argument,        0, OPT_VERIFY_BEHIND},
+    {"seed",             required_argument,  0, OPT_SEED},
     {"no-threads",       no_argument,        0, 't'},
+    {"threads",          required_argument,  0, OPT_THREADS},
+    {"ring-depth",       required_argument,  0, OPT_RING_DEPTH},
+    {"verbose",          no_argument,        0, OPT_VERBOSE},
+    {"fan-out",          no_argument,        0, OPT_FAN_OUT},
+    {"io",               required_argument,  0, OPT_IO},
+    {"queue-depth",      required_argument,  0, OPT_QUEUE_DEPTH},
+    {"streams",          required_argument,  0, OPT_STREAMS},
+    {"wavefront",        required_argument,  0, OPT_WAVEFRONT},
+    {"zeroout",          no_argument,        0, OPT_ZEROOUT},
+    {"dsync",            no_argument,        0, OPT_DSYNC},
     {"dry-run",          no_argument,        0, 'n'},
     {"help",             no_argument,        0, 'h'},
     {0, 0, 0, 0},
@@ -103,7 +164,7 @@ usage(int rc)
 "Usage: %s [OPTIONS] file [file...]\n"
 "  -v, --version           display scrub version and exit\n"
 "  -p, --pattern pat       select scrub pattern sequence\n"
-"  -b, --blocksize size    set I/O buffer size (default 4m)\n"
+"  -b, --blocksize size    set I/O buffer size (default 4m, or per device)\n"
 "  -s, --device-size size  set device size manually\n"
 "  -X, --freespace dir     create dir+files, fill until ENOSPC, then scrub\n"
 "  -D, --dirent newname    after scrubbing file, scrub dir entry, rename\n"
@@ -112,7 +173,28 @@ usage(int rc)
 "  -r, --remove            remove file after scrub\n"
 "  -L, --no-link           do not scrub link target\n"
 "  -R, --no-hwrand         do not use a hardware random number generator\n"
+"      --raw-hwrand        fill random passes directly from hardware generator\n"
+"      --rng name          random data generator: auto (fastest), aes, aesni,\n"
+"                          chacha, rdrand, gcrypt, or openssl\n"
+"      --verify-random     read back and check random passes\n"
+"      --verify-behind     check verify passes while they are written\n"
+"      --seed n            derive random data from n (for reproducible runs)\n"
 "  -t, --no-threads        do not compute random data in a parallel thread\n"
+"      --threads n         number of threads computing random data\n"
+"                          (default adapts to device speed)\n"
+"      --ring-depth n      number of random data buffers (default threads+2)\n"
+"      --io engine         I/O engine: auto, sync, uring, mmap, or splice\n"
+"      --queue-depth n     writes in flight with io_uring (default 16)\n"
+"      --streams n         write n regions of each target in parallel\n"
+"                          (default 4 on SSDs, else 1)\n"
+"      --wavefront n       write up to n passes at once, each a few flushed\n"
+"                          regions behind the one before\n"
+"      --zeroout           let block devices zero themselves for zero passes\n"
+"      --dsync             make each write durable instead of syncing at the\n"
+"                          end of each pass\n"
+"      --verbose           report I/O engine and random data thread changes\n"
+"      --fan-out           write each pass to all files at once, sharing\n"
+"                          the same random data between them\n"
 "  -n, --dry-run           verify file arguments, without writing\n"
 "  -h, --help              display this help message\n"
     , prog);
@@ -132,12 +214,13 @@ main(int argc, char *argv[])
     bool Dopt = false;  /* Rename flag */
     extern int optind;
     extern char *optarg;
+    char *end;
     int c;
 
     assert(sizeof(off_t) == 8);
 
     memset (&opt, 0, sizeof (opt));
-    opt.blocksize = BUFSIZE;
+    opt.blocksize = 0;  /* pick per target */
 
     /* Handle arguments.
      */
@@ -210,6 +293,79 @@ main(int argc, char *argv[])
         case 't':   /* --no-threads */
             opt.nothreads = true;
             break;
+#if HAVE_GETOPT_LONG
+        case OPT_THREADS:       /* --threads */
+            opt.threads = str2count(optarg, MAX_THREADS);
+            if (opt.threads == 0) {
+                fprintf(stderr, "%s: error parsing thread count\n", prog);
+                exit(1);
+            }
+            break;
+        case OPT_RING_DEPTH:    /* --ring-depth */
+            opt.ringdepth = str2count(optarg, MAX_RING_DEPTH);
+            if (opt.ringdepth == 0) {
+                fprintf(stderr, "%s: error parsing ring depth\n", prog);
+                exit(1);
+            }
+            break;
+        case OPT_RAW_HWRAND:    /* --raw-hwrand */
+            opt.rawhwrand = true;
+            break;
+        case OPT_RNG:           /* --rng */
+            opt.rng = optarg;
+            break;
+        case OPT_VERIFY_RANDOM: /* --verify-random */
+            opt.verifyrandom = true;
+            break;
+        case OPT_VERIFY_BEHIND: /* --verify-behind */
+            opt.verifybehind = true;
+            break;
+        case OPT_SEED:          /* --seed */
+            errno = 0;
+            opt.seed = strtoull(optarg, &end, 0);
+            if (errno != 0 || end == optarg || *end != '\0') {
+                fprintf(stderr, "%s: error parsing seed\n", prog);
+                exit(1);
+            }
+            opt.seeded = true;
+            break;
+        case OPT_VERBOSE:       /* --verbose */
+            opt.verbose = true;
+            break;
+        case OPT_FAN_OUT:       /* --fan-out */
+            opt.fanout = true;
+            break;
+        case OPT_IO:            /* --io */
+            opt.io = optarg;
+            break;
+        case OPT_QUEUE_DEPTH:   /* --queue-depth */
+            opt.iodepth = str2int(optarg);
+            if (opt.iodepth <= 0 || opt.iodepth > 4096) {
+                fprintf(stderr, "%s: error parsing queue depth\n", prog);
+                exit(1);
+            }
+            break;
+        case OPT_STREAMS:       /* --streams */
+            opt.streams = str2count(optarg, MAX_STREAMS);
+            if (opt.streams == 0) {
+                fprintf(stderr, "%s: error parsing stream count\n", prog);
+                exit(1);
+            }
+            break;
+        case OPT_WAVEFRONT:     /* --wavefront */
+            opt.wavefront = str2count(optarg, MAXSEQPATTERNS);
+            if (opt.wavefront == 0) {
+                fprintf(stderr, "%s: error parsing wavefront width\n", prog);
+                exit(1);
+            }
+            break;
+        case OPT_ZEROOUT:       /* --zeroout */
+            opt.zeroout = true;
+            break;
+        case OPT_DSYNC:         /* --dsync */
+            opt.dsync = true;
+            break;
+#endif
         case 'n':   /* --dry-run */
             nopt = true;
             break;
@@ -233,16 +389,75 @@ main(int argc, char *argv[])
         fprintf(stderr, "%s: -D can only be used with one file\n", prog);
         exit(1);
     }
+    if (opt.fanout && (opt.remove || opt.sparse || Xopt)) {
+        fprintf(stderr, "%s: --fan-out cannot be used with -r, -T, or -X\n",
+                prog);
+        exit(1);
+    }
 
     if (!opt.seq)
         opt.seq = seq_lookup("nnsa");
     assert(opt.seq != NULL);
-    printf("%s: using %s patterns\n", prog, opt.seq->desc);
 
+    if (opt.rawhwrand && opt.nohwrand) {
+        fprintf(stderr, "%s: --raw-hwrand and -R cannot be used together\n",
+                prog);
+        exit(1);
+    }
     if (opt.nohwrand)
         disable_hwrand();
+    if (opt.rawhwrand)
+        enable_raw_hwrand();
+    if (opt.rng && set_rng(opt.rng) < 0) {
+        fprintf(stderr, "%s: unsupported random number generator: %s\n",
+                prog, opt.rng);
+        exit(1);
+    }
+    if (opt.seeded)
+        set_seed(opt.seed);
     if (opt.nothreads)
         disable_threads();
+    if (opt.threads)
+        set_refill_threads(opt.threads);
+    if (opt.ringdepth)
+        set_refill_depth(opt.ringdepth);
+    if (opt.verbose)
+        set_fill_verbose(true);
+    if (opt.io && set_io_engine(opt.io) < 0) {
+        fprintf(stderr, "%s: unsupported I/O engine: %s\n", prog, opt.io);
+        exit(1);
+    }
+    if (opt.iodepth)
+        set_io_depth(opt.iodepth);
+    if (opt.streams)
+        set_fill_streams(opt.streams);
+    if (opt.dsync)
+        set_fill_dsync(true);
+
+    /* Pick the random data generator now so it can be reported.
+     */
+    if (!nopt && seq_random(opt.seq)) {
+        const char *rng;
+        double gbps;
+
+        if (initrand() < 0) {
+            fprintf (stderr, "%s: initrand: %s\n", prog, strerror(errno));
+            exit(1);
+        }
+        if (!genrand_repeatable() && (opt.verifyrandom || opt.seeded)) {
+            fprintf(stderr, "%s: --verify-random and --seed cannot be used "
+                    "with the hardware generator\n", prog);
+            exit(1);
+        }
+        rng = rng_info(&gbps);
+        if (gbps > 0)
+            printf("%s: using %s patterns, %s random data (%.2f GB/s)\n",
+                   prog, opt.seq->desc, rng, gbps);
+        else
+            printf("%s: using %s patterns, %s random data\n",
+                   prog, opt.seq->desc, rng);
+    } else
+        printf("%s: using %s patterns\n", prog, opt.seq->desc);
 
     /* Scrub free space
      */
@@ -270,9 +485,13 @@ main(int argc, char *argv[])
             fprintf (stderr, "%s: no files were scrubbed\n", prog);
             exit(1);
         }
-        for (i = optind; i < argc; i++) {
-            if (scrub_object(argv[i], &opt, false, nopt) > 0)
-                exit(1);
+        if (opt.fanout && !nopt)
+            scrub_fanout(&argv[optind], argc - optind, &opt);
+        else {
+            for (i = optind; i < argc; i++) {
+                if (scrub_object(argv[i], &opt, false, nopt) > 0)
+                    exit(1);
+            }
         }
     /* Scrub single file/device.
      */
@@ -417,24 +636,95 @@ static int progress_col (const sequence_t *seq)
     return col;
 }
 
+/* Report that 'path' did not read back as written, from 'offset' on,
+ * and exit.  'mismatch' is the number of bad bytes in that block.
+ */
+static void
+verify_error(char *path, off_t offset, size_t mismatch)
+{
+    if (mismatch > 0)
+        fprintf(stderr, "%s: %s: verification error at offset %lld "
+                "(%lu bytes differ in block)\n", prog, path,
+                (long long)offset, (unsigned long)mismatch);
+    else
+        fprintf(stderr, "%s: %s: verification error at offset %lld\n",
+                prog, path, (long long)offset);
+    exit(1);
+}
+
+/* Return the number of passes of 'seq' from 'i' on that can be written
+ * as one wavefront: nothing is read back between them and each is
+ * written with fillfile().
+ */
+static int
+wave_passes(const sequence_t *seq, int i, bool vrandom, bool zeroout)
+{
+    int n;
+
+    for (n = 0; i + n < seq->len; n++) {
+        const pattern_t *pat = &seq->pat[i + n];
+
+        if (pat->ptype == PAT_VERIFY)
+            break;
+        if (pat->ptype == PAT_RANDOM && vrandom)
+            break;
+        if (pat->ptype == PAT_NORMAL && zeroout && pat_zero(*pat))
+            break;
+    }
+    return n;
+}
+
+/* Zero 'path' with zerofile() for pattern 'pat'.  If that fails partway,
+ * the caller writes the whole pass with fillfile() instead, so start the
+ * progress bar 'p' over first.
+ */
+static off_t
+zero_pass(char *path, off_t size, unsigned char *patbuf, int bufsize,
+          pattern_t pat, prog_t p)
+{
+    char label[80];
+    off_t written;
+
+    written = zerofile(path, size, patbuf, bufsize,
+                       (progress_t)progress_update, p);
+    if (written == (off_t)-1) {
+        snprintf(label, sizeof(label), "%s: %-8s", prog, pat2str(pat));
+        progress_reset(p, label);
+    }
+    return written;
+}
+
 /* Scrub 'path', a file/device of size 'size'.
  * Fill using the pattern sequence specified by 'seq'.
  * Use 'bufsize' length for I/O buffers.
  * If 'enospc', return true if first pass ended with ENOSPC error.
+ * If 'vrandom', read back random passes and compare them with the
+ * regenerated random data.
+ * If 'zeroout', try to have a block device zero itself for zero passes,
+ * falling back to writing zeros if it can't.
+ * If 'vbehind', read back verify passes while they are being written.
+ * If 'wavefront' is non-zero, write runs of passes with nothing to read
+ * back between them up to 'wavefront' passes at a time, each pass a few
+ * flushed regions behind the one before.
  */
 static bool
 scrub(char *path, off_t size, const sequence_t *seq, int bufsize,
-      bool nosig, bool sparse, bool enospc)
+      bool nosig, bool sparse, bool enospc, bool vrandom, bool zeroout,
+      bool vbehind, int wavefront)
 {
-    unsigned char *buf;
-    int i;
+    unsigned char *buf = NULL, *patbuf;
+    behind_t behind;
+    wave_t wave = NULL;
+    size_t mismatch;
+    int i, n = 0, wavefirst = 0;
     prog_t p;
     char sizestr[80];
     bool isfull = false;
     off_t written = (off_t)-1, checked = (off_t)-1;
     int pcol = progress_col(seq);
 
-    if (!(buf = alloc_buffer(bufsize))) {
+    /* fixed pattern passes get their own buffers from alloc_pattern() */
+    if (seq_random(seq) && !(buf = alloc_buffer(bufsize))) {
         fprintf(stderr, "%s: out of memory\n", prog);
         exit(1);
     }
@@ -449,68 +739,142 @@ scrub(char *path, off_t size, const sequence_t *seq, int bufsize,
     for (i = 0; i < seq->len; i++) {
         if (i > 0)
             enospc = false;
+        if (wavefront && !wave && !sparse && !enospc
+                      && (n = wave_passes(seq, i, vrandom, zeroout)) > 1) {
+            if (churnrand() < 0) {
+                fprintf(stderr, "%s: churnrand: %s\n", prog,
+                         strerror(errno));
+                exit(1);
+            }
+            if (fillfile_wave(path, size, &seq->pat[i], n, bufsize,
+                              genrand_at, wavefront, &wave) == 0)
+                wavefirst = i;
+            else if (errno == ENOSYS)
+                wavefront = 0;  /* write passes one at a time */
+            else {
+                fprintf(stderr, "%s: %s: %s\n", prog, path,
+                         strerror(errno));
+                exit(1);
+            }
+        }
+        if (wave) {
+            printf("%s: %-8s", prog, seq->pat[i].ptype == PAT_RANDOM
+                                     ? "random" : pat2str(seq->pat[i]));
+            progress_create(&p, pcol);
+            written = fillfile_wave_pass(wave, i - wavefirst,
+                                         (progress_t)progress_update, p);
+            if (written == (off_t)-1) {
+                fprintf(stderr, "%s: %s: %s\n", prog, path,
+                         strerror(errno));
+                exit(1);
+            }
+            progress_destroy(p);
+            if (i == wavefirst + n - 1)
+                wave = NULL;    /* freed by fillfile_wave_pass() */
+            continue;
+        }
         switch (seq->pat[i].ptype) {
             case PAT_RANDOM:
                 printf("%s: %-8s", prog, "random");
                 progress_create(&p, pcol);
-#if !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL)
                 if (churnrand() < 0) {
                     fprintf(stderr, "%s: churnrand: %s\n", prog,
                              strerror(errno));
                     exit(1);
                 }
-#endif /* !defined(HAVE_LIBGCRYPT) && !defined(HAVE_OPENSSL) */
                 written = fillfile(path, size, buf, bufsize,
                                    (progress_t)progress_update, p,
-                                   (refill_t)genrand, sparse, enospc);
+                                   genrand_at, sparse, enospc);
                 if (written == (off_t)-1) {
                     fprintf(stderr, "%s: %s: %s\n", prog, path,
                              strerror(errno));
                     exit(1);
                 }
                 progress_destroy(p);
+                if (!vrandom)
+                    break;
+                printf("%s: %-8s", prog, "verify");
+                progress_create(&p, pcol);
+                checked = checkfile(path, written, buf, bufsize,
+                                    (progress_t)progress_update, p,
+                                    genrand_at, NULL, sparse, &mismatch);
+                if (checked == (off_t)-1) {
+                    fprintf(stderr, "%s: %s: %s\n", prog, path,
+                             strerror(errno));
+                    exit(1);
+                }
+                if (checked < written)
+                    verify_error(path, checked, mismatch);
+                progress_destroy(p);
                 break;
             case PAT_NORMAL:
                 printf("%s: %-8s", prog, pat2str(seq->pat[i]));
                 progress_create(&p, pcol);
-                memset_pat(buf, seq->pat[i], bufsize);
-                written = fillfile(path, size, buf, bufsize,
-                                   (progress_t)progress_update, p,
-                                   NULL, sparse, enospc);
+                if (!(patbuf = alloc_pattern(seq->pat[i], bufsize))) {
+                    fprintf(stderr, "%s: out of memory\n", prog);
+                    exit(1);
+                }
+                written = (off_t)-1;
+                if (zeroout && !sparse && pat_zero(seq->pat[i]))
+                    written = zero_pass(path, size, patbuf, bufsize,
+                                        seq->pat[i], p);
+                if (written == (off_t)-1)
+                    written = fillfile(path, size, patbuf, bufsize,
+                                       (progress_t)progress_update, p,
+                                       NULL, sparse, enospc);
                 if (written == (off_t)-1) {
                     fprintf(stderr, "%s: %s: %s\n", prog, path,
                              strerror(errno));
                     exit(1);
                 }
                 progress_destroy(p);
+                free_pattern(patbuf, seq->pat[i], bufsize);
                 break;
             case PAT_VERIFY:
                 printf("%s: %-8s", prog, pat2str(seq->pat[i]));
                 progress_create(&p, pcol);
-                memset_pat(buf, seq->pat[i], bufsize);
-                written = fillfile(path, size, buf, bufsize,
-                                   (progress_t)progress_update, p,
-                                   NULL, sparse, enospc);
+                if (!(patbuf = alloc_pattern(seq->pat[i], bufsize))) {
+                    fprintf(stderr, "%s: out of memory\n", prog);
+                    exit(1);
+                }
+                written = (off_t)-1;
+                behind = NULL;
+                if (zeroout && !sparse && pat_zero(seq->pat[i]))
+                    written = zero_pass(path, size, patbuf, bufsize,
+                                        seq->pat[i], p);
+                if (written == (off_t)-1 && vbehind && !sparse && !enospc)
+                    written = fillfile_behind(path, size, patbuf, bufsize,
+                                              (progress_t)progress_update, p,
+                                              &seq->pat[i], &behind);
+                else if (written == (off_t)-1)
+                    written = fillfile(path, size, patbuf, bufsize,
+                                       (progress_t)progress_update, p,
+                                       NULL, sparse, enospc);
                 if (written == (off_t)-1) {
                     fprintf(stderr, "%s: %s: %s\n", prog, path,
                              strerror(errno));
                     exit(1);
                 }
                 progress_destroy(p);
+                free_pattern(patbuf, seq->pat[i], bufsize);
                 printf("%s: %-8s", prog, "verify");
                 progress_create(&p, pcol);
-                checked = checkfile(path, written, buf, bufsize,
-                                    (progress_t)progress_update, p, sparse);
+                if (behind)
+                    checked = checkfile_behind(behind,
+                                               (progress_t)progress_update,
+                                               p, &mismatch);
+                else
+                    checked = checkfile(path, written, NULL, bufsize,
+                                        (progress_t)progress_update, p,
+                                        NULL, &seq->pat[i], sparse,
+                                        &mismatch);
                 if (checked == (off_t)-1) {
                     fprintf(stderr, "%s: %s: %s\n", prog, path,
                              strerror(errno));
                     exit(1);
                 }
-                if (checked < written) {
-                    fprintf(stderr, "%s: %s: verification error\n",
-                             prog, path);
-                    exit(1);
-                }
+                if (checked < written)
+                    verify_error(path, checked, mismatch);
                 progress_destroy(p);
                 break;
         }
@@ -533,7 +897,8 @@ scrub(char *path, off_t size, const sequence_t *seq, int bufsize,
         }
     }
 
-    free(buf);
+    if (buf)
+        free(buf);
     return isfull;
 }
 
@@ -576,6 +941,7 @@ scrub_free(char *dirpath, const struct opt_struct *opt)
     struct stat sb;
     bool isfull;
     off_t size = opt->devsize;
+    int bufsize = io_blocksize(dirpath, opt, NULL);
 
     /* Chdir to dirpath. Remain here throughout. */
     if (chdir(dirpath) < 0) {
@@ -602,8 +968,9 @@ scrub_free(char *dirpath, const struct opt_struct *opt)
     size = blkalign(size, sb.st_blksize, DOWN);
     do {
         snprintf(path, sizeof(path), "%s/scrub.%.3d", freespacedir, fileno++);
-        isfull = scrub(path, size, opt->seq, opt->blocksize, opt->nosig,
-                       false, true);
+        isfull = scrub(path, size, opt->seq, bufsize, opt->nosig,
+                       false, true, opt->verifyrandom, false,
+                       opt->verifybehind, opt->wavefront);
     } while (!isfull);
     while (--fileno >= 0) {
         snprintf(path, sizeof(path), "%s/scrub.%.3d", freespacedir, fileno);
@@ -652,10 +1019,11 @@ scrub_dirent(char *path, const struct opt_struct *opt)
     }
 }
 
-/* Scrub a regular file.
+/* Determine the number of bytes to scrub in a regular file.
+ * Return 0 if there is nothing to scrub.
  */
-static void
-scrub_file(char *path, const struct opt_struct *opt)
+static off_t
+file_size(char *path, const struct opt_struct *opt)
 {
     struct stat sb;
     filetype_t ftype = filetype(path);
@@ -673,7 +1041,7 @@ scrub_file(char *path, const struct opt_struct *opt)
     } else  {
         if (sb.st_size == 0) {
             fprintf(stderr, "%s: warning: %s is zero length\n", prog, path);
-            return;
+            return 0;
         }
         size = blkalign(sb.st_size, sb.st_blksize, UP);
         if (size != sb.st_size) {
@@ -681,7 +1049,21 @@ scrub_file(char *path, const struct opt_struct *opt)
                     prog, path, (int)(size - sb.st_size));
         }
     }
-    scrub(path, size, opt->seq, opt->blocksize, opt->nosig, opt->sparse, false);
+    return size;
+}
+
+/* Scrub a regular file.
+ */
+static void
+scrub_file(char *path, const struct opt_struct *opt)
+{
+    off_t size = file_size(path, opt);
+    int bufsize = io_blocksize(path, opt, NULL);
+
+    if (size == 0)
+        return;
+    scrub(path, size, opt->seq, bufsize, opt->nosig, opt->sparse, false,
+          opt->verifyrandom, false, opt->verifybehind, opt->wavefront);
 }
 
 /* Scrub apple resource fork component of file.
@@ -709,14 +1091,16 @@ scrub_resfork(char *path, const struct opt_struct *opt)
         printf("%s: padding %s with %d bytes to fill last fs block\n",
                         prog, rpath, (int)(rsize - rsb.st_size));
     }
-    scrub(rpath, rsize, opt->seq, opt->blocksize, false, false, false);
+    scrub(rpath, rsize, opt->seq, io_blocksize(path, opt, NULL), false,
+          false, false,
+          opt->verifyrandom, false, opt->verifybehind, opt->wavefront);
 }
 #endif
 
-/* Scrub a special file corresponding to a disk.
+/* Determine the number of bytes to scrub in a special file.
  */
-static void
-scrub_disk(char *path, const struct opt_struct *opt)
+static off_t
+disk_size(char *path, const struct opt_struct *opt)
 {
     filetype_t ftype = filetype(path);
     off_t devsize = opt->devsize;
@@ -730,8 +1114,204 @@ scrub_disk(char *path, const struct opt_struct *opt)
         }
         printf("%s: please verify that device size below is correct!\n", prog);
     }
-    scrub(path, devsize, opt->seq, opt->blocksize, opt->nosig, opt->sparse,
-          false);
+    return devsize;
+}
+
+/* Scrub a special file corresponding to a disk.
+ */
+static void
+scrub_disk(char *path, const struct opt_struct *opt)
+{
+    off_t size = disk_size(path, opt);
+    int bufsize, align;
+
+    bufsize = io_blocksize(path, opt, &align);
+    set_buffer_alignment(align);
+    scrub(path, size, opt->seq, bufsize, opt->nosig, opt->sparse, false,
+          opt->verifyrandom, opt->zeroout, opt->verifybehind,
+          opt->wavefront);
+    set_buffer_alignment(0);
+}
+
+/* Pick the I/O block size for 'path', and in 'alignp' (if non-NULL) a
+ * buffer alignment, 0 for the default.  Unless -b was given, block
+ * devices get the largest request the block layer passes to the device
+ * without splitting it (rounded to the optimal I/O size where the device
+ * reports one, e.g. a RAID stripe), and other files BUFSIZE.  Buffers
+ * for block devices are aligned to the physical sector size.
+ */
+static int
+io_blocksize(char *path, const struct opt_struct *opt, int *alignp)
+{
+    topology_t t;
+    int bs = BUFSIZE;
+
+    if (alignp)
+        *alignp = 0;
+    if (filetype(path) != FILE_BLOCK || gettopology(path, &t) < 0)
+        return opt->blocksize ? opt->blocksize : BUFSIZE;
+    if (alignp)
+        *alignp = t.physical > t.logical ? t.physical : t.logical;
+    if (t.max_io > 0) {
+        bs = t.max_io;
+        if (t.io_opt > bs)
+            bs = t.io_opt;
+        else if (t.io_opt > 0)
+            bs -= bs % t.io_opt;
+        else if (t.physical > 0)
+            bs -= bs % t.physical;
+    } else if (t.io_opt > 0 && t.io_opt < BUFSIZE)
+        bs = BUFSIZE - BUFSIZE % t.io_opt;
+    else if (t.io_opt > 0)
+        bs = t.io_opt;
+    if (opt->blocksize)
+        bs = opt->blocksize;
+    if (opt->verbose)
+        fprintf(stderr, "%s: %s: %d/%d byte sectors, I/O min %d opt %d "
+                "max %d, using %d byte blocks\n", prog, path, t.logical,
+                t.physical, t.io_min, t.io_opt, t.max_io, bs);
+    return bs;
+}
+
+/* Read back each of 'count' files and compare it with the pass just
+ * written (fixed pattern 'pat', or random data from 'refill'), exiting
+ * on a mismatch.
+ */
+static void
+fanout_check(char **paths, off_t *sizes, int count, unsigned char *buf,
+             int bufsize, refill_t refill, const pattern_t *pat, int pcol)
+{
+    prog_t p;
+    off_t checked;
+    size_t mismatch;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        printf("%s: %-8s", prog, "verify");
+        progress_create(&p, pcol);
+        checked = checkfile(paths[i], sizes[i], buf, bufsize,
+                            (progress_t)progress_update, p, refill, pat,
+                            false, &mismatch);
+        if (checked == (off_t)-1) {
+            fprintf(stderr, "%s: %s: %s\n", prog, paths[i], strerror(errno));
+            exit(1);
+        }
+        if (checked < sizes[i])
+            verify_error(paths[i], checked, mismatch);
+        progress_destroy(p);
+    }
+}
+
+/* Scrub 'count' files/devices together (--fan-out): each pass is written
+ * to all of them from the same buffers, so a random pass is generated
+ * once rather than once per target.  Every target receives the same
+ * random data.
+ */
+static void
+scrub_fanout(char **paths, int count, const struct opt_struct *opt)
+{
+    const sequence_t *seq = opt->seq;
+    char **fpaths;
+    off_t *sizes;
+    unsigned char *buf;
+    char sizestr[80];
+    int i, n = 0, failed;
+    int bs, align, bufsize = 0, maxalign = 0;
+    int pcol = progress_col(seq);
+    prog_t p;
+
+    if (!(fpaths = malloc(count * sizeof(char *)))
+            || !(sizes = malloc(count * sizeof(off_t)))) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        exit(1);
+    }
+    for (i = 0; i < count; i++) {
+        /* as in scrub_object(), -L leaves the target of a link alone */
+        if (filetype(paths[i]) == FILE_REGULAR && is_symlink(paths[i])
+                                               && opt->nofollow)
+            continue;
+        if (filetype(paths[i]) == FILE_REGULAR)
+            sizes[n] = file_size(paths[i], opt);
+        else
+            sizes[n] = disk_size(paths[i], opt);
+        if (sizes[n] == 0)
+            continue;
+        fpaths[n] = paths[i];
+        size2str(sizestr, sizeof(sizestr), sizes[n]);
+        printf("%s: scrubbing %s %s\n", prog, fpaths[n], sizestr);
+        bs = io_blocksize(paths[i], opt, &align);
+        if (bufsize == 0 || bs < bufsize)
+            bufsize = bs;
+        if (align > maxalign)
+            maxalign = align;
+        n++;
+    }
+    buf = NULL;
+    if (n == 0)
+        goto done;
+    set_buffer_alignment(maxalign);
+    if (seq_random(seq) && !(buf = alloc_buffer(bufsize))) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        exit(1);
+    }
+    if (seq_random(seq))
+        printf("%s: warning: random passes write the same data to all %d "
+               "targets\n", prog, n);
+
+    for (i = 0; i < seq->len; i++) {
+        refill_t refill = NULL;
+        unsigned char *patbuf = NULL;
+
+        if (seq->pat[i].ptype == PAT_RANDOM) {
+            printf("%s: %-8s", prog, "random");
+            if (churnrand() < 0) {
+                fprintf(stderr, "%s: churnrand: %s\n", prog,
+                         strerror(errno));
+                exit(1);
+            }
+            refill = genrand_at;
+        } else {
+            printf("%s: %-8s", prog, pat2str(seq->pat[i]));
+            if (!(patbuf = alloc_pattern(seq->pat[i], bufsize))) {
+                fprintf(stderr, "%s: out of memory\n", prog);
+                exit(1);
+            }
+        }
+        progress_create(&p, pcol);
+        if (fillfiles(fpaths, sizes, n, patbuf ? patbuf : buf, bufsize,
+                      (progress_t)progress_update, p, refill,
+                      &failed) == (off_t)-1) {
+            fprintf(stderr, "%s: %s: %s\n", prog, fpaths[failed],
+                     strerror(errno));
+            exit(1);
+        }
+        progress_destroy(p);
+        if (patbuf)
+            free_pattern(patbuf, seq->pat[i], bufsize);
+        if (seq->pat[i].ptype == PAT_VERIFY)
+            fanout_check(fpaths, sizes, n, NULL, bufsize, NULL,
+                         &seq->pat[i], pcol);
+        else if (refill && opt->verifyrandom)
+            fanout_check(fpaths, sizes, n, buf, bufsize, refill, NULL, pcol);
+    }
+    for (i = 0; i < n && !opt->nosig; i++) {
+        if (writesig(fpaths[i]) < 0) {
+            fprintf(stderr, "%s: writing signature to %s: %s\n", prog,
+                    fpaths[i], strerror (errno));
+            exit (1);
+        }
+    }
+#if __APPLE__
+    for (i = 0; i < n; i++)
+        if (filetype(fpaths[i]) == FILE_REGULAR)
+            scrub_resfork(fpaths[i], opt);
+#endif
+done:
+    if (buf)
+        free(buf);
+    set_buffer_alignment(0);
+    free(sizes);
+    free(fpaths);
 }
 
 /*
@@ -0,0 +1,353 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Minimal io_uring interface for fillfile.c, using the raw system calls
+ * so no liburing is needed.  One ring serves one file, which is
+ * registered with the kernel along with (if possible) the I/O buffers.
+ * Callers keep no more requests in flight than the ring depth.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "util.h"
+#include "uring.h"
+
+/* IORING_OP_READ and IORING_OP_WRITE arrived in Linux 5.6 together with
+ * IORING_FEAT_RW_CUR_POS, which is used to detect them at run time.
+ */
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup) \
+        && defined(IORING_FEAT_RW_CUR_POS)
+
+struct uring_struct {
+    int ringfd;
+    int fd;             /* target fd, or 0 if registered */
+    bool fixed_file;
+    bool fixed_bufs;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned queued;    /* sqes not yet handed to the kernel */
+    unsigned write_flags;
+};
+
+static int
+sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_enter(int ringfd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ringfd, submit, complete, flags,
+                   NULL, 0);
+}
+
+static int
+sys_register(int ringfd, unsigned op, void *arg, unsigned nargs)
+{
+    return syscall(__NR_io_uring_register, ringfd, op, arg, nargs);
+}
+
+/* Return true if the kernel supports io_uring with plain reads and writes.
+ * It may be compiled in but disabled, e.g. by kernel.io_uring_disabled.
+ */
+bool
+uring_available(void)
+{
+    static int avail = -1;
+    struct io_uring_params p;
+    int fd;
+
+    if (avail == -1) {
+        memset(&p, 0, sizeof(p));
+        avail = 0;
+        if ((fd = sys_setup(1, &p)) >= 0) {
+            if (p.features & IORING_FEAT_RW_CUR_POS)
+                avail = 1;
+            (void)close(fd);
+        }
+    }
+    return avail;
+}
+
+void
+uring_destroy(uring_t u)
+{
+    if (u->sqes)
+        (void)munmap(u->sqes, u->sqes_size);
+    if (u->cq_ptr)
+        (void)munmap(u->cq_ptr, u->cq_size);
+    if (u->sq_ptr)
+        (void)munmap(u->sq_ptr, u->sq_size);
+    if (u->ringfd != -1)
+        (void)close(u->ringfd);
+    free(u);
+}
+
+static void *
+ring_map(int ringfd, size_t size, off_t offset)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringfd, offset);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Set up a ring of 'depth' entries for I/O on 'fd'.
+ */
+int
+uring_create(uring_t *up, int fd, int depth)
+{
+    struct io_uring_params p;
+    uring_t u;
+
+    if (!(u = malloc(sizeof(struct uring_struct)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(u, 0, sizeof(struct uring_struct));
+    memset(&p, 0, sizeof(p));
+    if ((u->ringfd = sys_setup(depth, &p)) < 0)
+        goto error;
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        errno = ENOSYS;
+        goto error;
+    }
+    u->sq_entries = p.sq_entries;
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (!(u->sq_ptr = ring_map(u->ringfd, u->sq_size, IORING_OFF_SQ_RING)))
+        goto error;
+    if (!(u->cq_ptr = ring_map(u->ringfd, u->cq_size, IORING_OFF_CQ_RING)))
+        goto error;
+    if (!(u->sqes = ring_map(u->ringfd, u->sqes_size, IORING_OFF_SQES)))
+        goto error;
+    u->sq_head = (unsigned *)((char *)u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+    /* A registered fd saves a file table lookup per request */
+    if (sys_register(u->ringfd, IORING_REGISTER_FILES, &fd, 1) == 0)
+        u->fixed_file = true;
+    else
+        u->fd = fd;
+    *up = u;
+    return 0;
+error:
+    uring_destroy(u);
+    return -1;
+}
+
+/* Register 'nbufs' buffers of 'bufsize' bytes so requests on them skip
+ * the per-I/O page pinning.  This counts against RLIMIT_MEMLOCK, so
+ * failure is not fatal: requests then name the buffer by address.
+ */
+int
+uring_register_buffers(uring_t u, unsigned char **bufs, int nbufs,
+                       int bufsize)
+{
+    struct iovec *iov;
+    int i, rc;
+
+    if (!(iov = malloc(nbufs * sizeof(struct iovec)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < nbufs; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = bufsize;
+    }
+    rc = sys_register(u->ringfd, IORING_REGISTER_BUFFERS, iov, nbufs);
+    if (rc == 0)
+        u->fixed_bufs = true;
+    free(iov);
+    return rc < 0 ? -1 : 0;
+}
+
+/* Make every later write durable on completion (RWF_DSYNC).
+ */
+int
+uring_set_dsync(uring_t u)
+{
+#ifdef RWF_DSYNC
+    u->write_flags = RWF_DSYNC;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Hand queued requests to the kernel.
+ */
+static int
+uring_flush(uring_t u)
+{
+    int n;
+
+    while (u->queued > 0) {
+        if ((n = sys_enter(u->ringfd, u->queued, 0, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        u->queued -= n;
+    }
+    return 0;
+}
+
+/* Queue a read or write of 'len' bytes at 'offset' to or from 'buf',
+ * which lies within registered buffer 'bufidx' (or -1 if none).
+ * 'tag' is returned with the completion.
+ */
+int
+uring_queue(uring_t u, bool write, unsigned char *buf, int bufidx,
+            int len, off_t offset, unsigned long long tag)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *u->sq_tail;
+    unsigned idx;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)
+            >= u->sq_entries) {
+        if (uring_flush(u) < 0)
+            return -1;
+    }
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    if (u->fixed_bufs && bufidx >= 0) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = bufidx;
+    } else
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = u->fd;
+    if (u->fixed_file)
+        sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    if (write)
+        sqe->rw_flags = u->write_flags;
+    sqe->user_data = tag;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+    return 0;
+}
+
+/* Submit anything queued and wait for one completion.  Its tag goes in
+ * 'tagp' and its result (bytes transferred or -errno) in 'resp'.
+ */
+int
+uring_reap(uring_t u, unsigned long long *tagp, int *resp)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int n;
+
+    if (uring_flush(u) < 0)
+        return -1;
+    for (;;) {
+        head = *u->cq_head;
+        if (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        n = sys_enter(u->ringfd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0 && errno != EINTR)
+            return -1;
+    }
+    cqe = &u->cqes[head & *u->cq_mask];
+    *tagp = cqe->user_data;
+    *resp = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+bool
+uring_available(void)
+{
+    return false;
+}
+
+int
+uring_create(uring_t *up, int fd, int depth)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_register_buffers(uring_t u, unsigned char **bufs, int nbufs,
+                       int bufsize)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_set_dsync(uring_t u)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_queue(uring_t u, bool write, unsigned char *buf, int bufidx,
+            int len, off_t offset, unsigned long long tag)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_reap(uring_t u, unsigned long long *tagp, int *resp)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void
+uring_destroy(uring_t u)
+{
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,29 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Requires util.h (for bool) to be included first.
+ */
+
+typedef struct uring_struct *uring_t;
+
+bool uring_available(void);
+int  uring_create(uring_t *up, int fd, int depth);
+int  uring_register_buffers(uring_t u, unsigned char **bufs, int nbufs,
+                            int bufsize);
+int  uring_set_dsync(uring_t u);
+int  uring_queue(uring_t u, bool write, unsigned char *buf, int bufidx,
+                 int len, off_t offset, unsigned long long tag);
+int  uring_reap(uring_t u, unsigned long long *tagp, int *resp);
+void uring_destroy(uring_t u);
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
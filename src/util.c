@@ -14,6 +14,7 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -39,6 +40,25 @@ read_all(int fd, unsigned char *buf, int count)
     return n;
 }
 
+/* Handles short reads but otherwise just like pread(2).
+ */
+int
+pread_all(int fd, unsigned char *buf, int count, off_t offset)
+{
+    int n;
+
+    do {
+        n = pread(fd, buf, count, offset);
+        if (n > 0) {
+            count -= n;
+            buf += n;
+            offset += n;
+        }
+    } while (n > 0 && count > 0);
+
+    return n;
+}
+
 /* Handles short writes but otherwise just like write(2).
  */
 int
@@ -57,6 +77,66 @@ write_all(int fd, const unsigned char *buf, int count)
     return n;
 }
 
+/* Handles short writes but otherwise just like pwrite(2).
+ */
+int
+pwrite_all(int fd, const unsigned char *buf, int count, off_t offset)
+{
+    int n;
+
+    do {
+        n = pwrite(fd, buf, count, offset);
+        if (n > 0) {
+            count -= n;
+            buf += n;
+            offset += n;
+        }
+    } while (n > 0 && count > 0);
+
+    return n;
+}
+
+/* Like pwrite_all(), but the data is on stable storage when it returns,
+ * as if the file had been opened with O_DSYNC.  This uses pwritev2()
+ * with RWF_DSYNC, which the kernel may turn into FUA writes, or else
+ * pwrite() and fdatasync().  If 'offset' is -1, write at the current file
+ * offset like write_all().
+ */
+int
+pwrite_dsync(int fd, const unsigned char *buf, int count, off_t offset)
+{
+    int n;
+#if HAVE_PWRITEV2 && defined(RWF_DSYNC)
+    /* shared by stream and wavefront writer threads */
+    static bool nodsync = false;
+    struct iovec iov;
+
+    if (!__atomic_load_n(&nodsync, __ATOMIC_RELAXED)) {
+        do {
+            iov.iov_base = (void *)buf;
+            iov.iov_len = count;
+            n = pwritev2(fd, &iov, 1, offset, RWF_DSYNC);
+            if (n > 0) {
+                count -= n;
+                buf += n;
+                if (offset != -1)
+                    offset += n;
+            }
+        } while (n > 0 && count > 0);
+        if (n >= 0 || (errno != ENOSYS && errno != EOPNOTSUPP))
+            return n;
+        __atomic_store_n(&nodsync, true, __ATOMIC_RELAXED);
+    }
+#endif
+    if (offset == -1)
+        n = write_all(fd, buf, count);
+    else
+        n = pwrite_all(fd, buf, count, offset);
+    if (n > 0 && fdatasync(fd) < 0 && errno != EINVAL)
+        return -1;
+    return n;
+}
+
 /* Indicates whether the file represented by 'path' is a symlink.
  */
 int
@@ -109,22 +189,47 @@ blkalign(off_t offset, int blocksize, round_t rtype)
     return offset;
 }
 
+static int buf_align = 0;       /* 0 means the page size */
+
+/* Align buffers from alloc_buffer() to 'align' bytes, a power of 2 such
+ * as the physical sector size of the next target.  0 restores the
+ * default, the page size, which suits O_DIRECT on nearly any device.
+ */
+void
+set_buffer_alignment(int align)
+{
+    buf_align = align;
+}
+
+static size_t
+buffer_alignment(void)
+{
+    long align = buf_align;
+
+#ifdef _SC_PAGESIZE
+    if (align < sysconf(_SC_PAGESIZE))
+        align = sysconf(_SC_PAGESIZE);
+#endif
+    if (align < 4096)
+        align = 4096;
+    return align;
+}
+
 /* Allocate an aligned buffer
  */
-#define ALIGNMENT	(16*1024*1024) /* Hopefully good enough */
 void *
 alloc_buffer(int bufsize)
 {
     void *ptr;
 
 #ifdef HAVE_POSIX_MEMALIGN
-    int err = posix_memalign(&ptr, ALIGNMENT, bufsize);
+    int err = posix_memalign(&ptr, buffer_alignment(), bufsize);
     if (err) {
         errno = err;
         ptr = NULL;
     }
 #elif defined(HAVE_MEMALIGN)
-    ptr = memalign(ALIGNMENT, bufsize);
+    ptr = memalign(buffer_alignment(), bufsize);
 #else
     ptr = malloc(bufsize);	/* Hope for the best? */
 #endif
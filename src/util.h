@@ -30,10 +30,16 @@ typedef enum {
 typedef enum { UP, DOWN } round_t;
 
 int         read_all(int fd, unsigned char *buf, int count);
+int         pread_all(int fd, unsigned char *buf, int count, off_t offset);
 int         write_all(int fd, const unsigned char *buf, int count);
+int         pwrite_all(int fd, const unsigned char *buf, int count,
+                       off_t offset);
+int         pwrite_dsync(int fd, const unsigned char *buf, int count,
+                         off_t offset);
 int         is_symlink(char *path);
 filetype_t  filetype(char *path);
 off_t       blkalign(off_t offset, int blocksize, round_t rtype);
+void        set_buffer_alignment(int align);
 void *      alloc_buffer(int bufsize);
 
 /*
@@ -23,9 +23,12 @@
 #endif
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <libgen.h>
 
+#include "util.h"
 #include "aes.h"
+#include "aesni.h"
 
 char *prog;
 
@@ -54,17 +57,115 @@ static unsigned char AES_dec_test[3][16] =
       0x84, 0x60, 0x4D, 0x60, 0x27, 0x1B, 0xC5, 0x9A }
 };
 
+/*
+ * Reference CTR keystream: aes_encrypt() on a counter incremented
+ * like genrand.c::incr128()
+ */
+
+static void sw_ctr( aes_context *ctx, unsigned char ctr[16],
+                    unsigned char *buf, int buflen )
+{
+    unsigned long long t[2];
+    unsigned char out[16];
+    int i, len;
+
+    for( i = 0; i < buflen; i += 16 )
+    {
+        aes_encrypt( ctx, ctr, out );
+        memcpy( t, ctr, 16 );
+        if( ++t[0] == 0 )
+            ++t[1];
+        memcpy( ctr, t, 16 );
+        len = buflen - i < 16 ? buflen - i : 16;
+        memcpy( &buf[i], out, len );
+    }
+}
+
+/*
+ * Compare hardware CTR keystream against the reference over a run of
+ * odd buffer lengths, starting just short of a 64-bit counter carry.
+ */
+
+static int ctr_test( aesctr_t hw_ctr, int nbits )
+{
+    static int lens[] = { 1, 15, 16, 17, 127, 128, 129, 255, 256, 257,
+                          1000, 4103, 65536 };
+    aes_context ctx;
+    aesni_context ni;
+    unsigned char key[32], c1[16], c2[16];
+    unsigned char b1[65536], b2[65536];
+    unsigned long long t[2] = { ~0ULL - 300, 42 };
+    int i;
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (unsigned char) ( i * 7 + nbits );
+    aes_set_key( &ctx, key, nbits );
+    aesni_set_key( &ni, &ctx );
+    memcpy( c1, t, 16 );
+    memcpy( c2, t, 16 );
+
+    for( i = 0; i < (int)( sizeof( lens ) / sizeof( lens[0] ) ); i++ )
+    {
+        sw_ctr( &ctx, c1, b1, lens[i] );
+        hw_ctr( &ni, c2, b2, lens[i] );
+        if( memcmp( b1, b2, lens[i] ) != 0 || memcmp( c1, c2, 16 ) != 0 )
+            return( 1 );
+    }
+    return( 0 );
+}
+
 int main(int argc, char *argv[])
 {
     int m, n, i, j;
     aes_context ctx;
+    aesni_context ni;
     unsigned char buf[16];
     unsigned char key[32];
+    aesctr_t hw_ctr = NULL;
+    char *hw_name = NULL;
 
     prog = basename(argv[0]);
 
+    /* "aestest aesni" or "aestest vaes" tests the hardware paths */
+    if( argc > 1 && strcmp( argv[1], "aesni" ) == 0 )
+    {
+        if( !aesni_available() )
+            exit( 77 );
+        hw_ctr = aesni_ctr;
+        hw_name = "AES-NI";
+    }
+    else if( argc > 1 && strcmp( argv[1], "vaes" ) == 0 )
+    {
+        if( !vaes_available() )
+            exit( 77 );
+        hw_ctr = vaes_ctr;
+        hw_name = "VAES";
+    }
+
+    if( hw_ctr )
+    {
+        for( n = 0; n < 3; n++ )
+        {
+            printf( " CTR keystream (%s), key size = %3d bits: ",
+                    hw_name, 128 + n * 64 );
+
+            if( ctr_test( hw_ctr, 128 + n * 64 ) != 0 )
+            {
+                printf( "failed!\n" );
+                return( 1 );
+            }
+
+            printf( "passed.\n" );
+        }
+        if( hw_ctr == vaes_ctr )
+            return( 0 );
+    }
+
     for( m = 0; m < 2; m++ )
     {
+        /* AES-NI path only implements encryption */
+        if( hw_ctr && m == 1 ) break;
+
         printf( "\n Rijndael Monte Carlo Test (ECB mode) - " );
 
         if( m == 0 ) printf( "encryption\n\n" );
@@ -83,10 +184,12 @@ int main(int argc, char *argv[])
             for( i = 0; i < 400; i++ )
             {
                 aes_set_key( &ctx, key, 128 + n * 64 );
+                aesni_set_key( &ni, &ctx );
 
                 for( j = 0; j < 9999; j++ )
                 {
-                    if( m == 0 ) aes_encrypt( &ctx, buf, buf );
+                    if( m == 0 && hw_ctr ) aesni_encrypt( &ni, buf, buf );
+                    else if( m == 0 ) aes_encrypt( &ctx, buf, buf );
                     if( m == 1 ) aes_decrypt( &ctx, buf, buf );
                 }
 
@@ -98,7 +201,8 @@ int main(int argc, char *argv[])
                     }
                 }
 
-                if( m == 0 ) aes_encrypt( &ctx, buf, buf );
+                if( m == 0 && hw_ctr ) aesni_encrypt( &ni, buf, buf );
+                else if( m == 0 ) aes_encrypt( &ctx, buf, buf );
                 if( m == 1 ) aes_decrypt( &ctx, buf, buf );
 
                 for( j = 0; j < 16; j++ )
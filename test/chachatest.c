@@ -0,0 +1,143 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Check a ChaCha20 kernel against published test vectors and, for the
+ * SIMD kernels, against the reference code over many lengths and
+ * starting blocks.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libgen.h>
+
+#include "util.h"
+#include "chacha.h"
+
+char *prog;
+
+/* RFC 7539 A.1 test vectors #1 and #2: all-zero key and nonce,
+ * blocks 0 and 1.
+ */
+static unsigned char zero_test[2 * CHACHA_BLOCK_SZ] =
+{
+    0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+    0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+    0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
+    0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+    0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d,
+    0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+    0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c,
+    0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86,
+    0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a,
+    0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+    0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69,
+    0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+    0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43,
+    0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+    0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45,
+    0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f
+};
+
+/* RFC 7539 2.3.2 block function test vector: key 00..1f, 32-bit block
+ * count 1 and nonce 00 00 00 09 00 00 00 4a 00 00 00 00.  In the 64-bit
+ * counter layout the first nonce word is the high half of the counter.
+ */
+static unsigned char rfc_test[CHACHA_BLOCK_SZ] =
+{
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+    0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+    0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+    0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+    0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+    0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+    0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+    0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+};
+
+#define MAXLEN      (40 * CHACHA_BLOCK_SZ + 63)
+
+static int vector_test(chachafn_t fn)
+{
+    chacha_context ctx;
+    unsigned char key[CHACHA_KEY_SZ], nonce[CHACHA_NONCE_SZ];
+    unsigned char buf[2 * CHACHA_BLOCK_SZ];
+    int i;
+
+    memset(key, 0, sizeof(key));
+    memset(nonce, 0, sizeof(nonce));
+    chacha_set_key(&ctx, key, nonce);
+    fn(&ctx, 0, buf, sizeof(buf));
+    if (memcmp(buf, zero_test, sizeof(zero_test)) != 0)
+        return 1;
+
+    for (i = 0; i < CHACHA_KEY_SZ; i++)
+        key[i] = i;
+    nonce[3] = 0x4a;
+    chacha_set_key(&ctx, key, nonce);
+    fn(&ctx, 1 | (0x09000000ULL << 32), buf, CHACHA_BLOCK_SZ);
+    if (memcmp(buf, rfc_test, sizeof(rfc_test)) != 0)
+        return 1;
+    return 0;
+}
+
+/* Compare 'fn' with chacha_ref() for every length up to MAXLEN, starting
+ * at a block where the low 32 bits of the counter wrap partway through.
+ */
+static int ref_test(chachafn_t fn)
+{
+    static unsigned char ref[MAXLEN], buf[MAXLEN + 1];
+    chacha_context ctx;
+    unsigned char key[CHACHA_KEY_SZ], nonce[CHACHA_NONCE_SZ];
+    unsigned long long block = 0xffffffffULL - 5;
+    int i, len;
+
+    for (i = 0; i < CHACHA_KEY_SZ; i++)
+        key[i] = i * 7 + 3;
+    for (i = 0; i < CHACHA_NONCE_SZ; i++)
+        nonce[i] = i * 13 + 1;
+    chacha_set_key(&ctx, key, nonce);
+    chacha_ref(&ctx, block, ref, MAXLEN);
+
+    for (len = 1; len <= MAXLEN; len++) {
+        buf[len] = 0x5a;
+        fn(&ctx, block, buf, len);
+        if (memcmp(buf, ref, len) != 0 || buf[len] != 0x5a)
+            return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    chachafn_t fn;
+    char *name = argc > 1 ? argv[1] : "ref";
+
+    prog = basename(argv[0]);
+
+    if (!(fn = chacha_lookup(name))) {
+        fprintf(stderr, "%s: %s kernel not available\n", prog, name);
+        exit(77);
+    }
+
+    printf(" ChaCha20 test vectors (%s): %s\n", name,
+           vector_test(fn) ? "failed!" : "passed.");
+    printf(" ChaCha20 keystream vs reference (%s): %s\n", name,
+           ref_test(fn) ? "failed!" : "passed.");
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
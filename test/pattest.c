@@ -0,0 +1,179 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Check a pattern fill and compare kernel against the reference code
+ * for every pattern length, at every alignment, over many lengths, and
+ * over one buffer big enough for non-temporal stores.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libgen.h>
+
+#include "util.h"
+#include "pattern.h"
+
+char *prog;
+
+#define MAXLEN      (16 * 64 + 100)
+#define BIGLEN      (9 * 1024 * 1024 + 77)
+#define GUARD       0x5a
+
+static void make_pat(pattern_t *p, int len)
+{
+    int i;
+
+    p->ptype = PAT_NORMAL;
+    p->len = len;
+    for (i = 0; i < len; i++)
+        p->pat[i] = (i * 37 + len) & 0xff;
+}
+
+/* Compare 'fn' with the reference kernel for pattern lengths 1 to
+ * MAXPATBYTES, starting at each offset into a 64-byte aligned buffer,
+ * over every length to 256 and a spread of lengths beyond.
+ */
+static int small_test(patfn_t fn, patfn_t ref)
+{
+    static unsigned char refbuf[MAXLEN];
+    unsigned char *buf;
+    pattern_t p;
+    int plen, off, len;
+
+    if (!(buf = alloc_buffer(MAXLEN + 64 + 1)))
+        return 1;
+    for (plen = 1; plen <= MAXPATBYTES; plen++) {
+        make_pat(&p, plen);
+        ref(refbuf, p, MAXLEN);
+        for (off = 0; off < 64; off++) {
+            for (len = 0; len <= MAXLEN; len += len < 256 ? 1 : 13) {
+                buf[off + len] = GUARD;
+                fn(buf + off, p, len);
+                if (memcmp(buf + off, refbuf, len) != 0
+                        || buf[off + len] != GUARD) {
+                    free(buf);
+                    return 1;
+                }
+            }
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+/* Check that 'fn' finds the same number of bad bytes and the same
+ * first one as the reference compare kernel.
+ */
+static int cmp_check(patcmpfn_t fn, patcmpfn_t ref, unsigned char *buf,
+                     pattern_t p, size_t phase, size_t len)
+{
+    size_t first = 0, rfirst = 0, bad, rbad;
+
+    bad = fn(buf, p, phase, len, &first);
+    rbad = ref(buf, p, phase, len, &rfirst);
+    return bad != rbad || (bad > 0 && first != rfirst);
+}
+
+/* Compare 'cfn' with the reference compare kernel for pattern lengths 1
+ * to MAXPATBYTES, starting at each offset into a 64-byte aligned buffer
+ * and at varying pattern phases, on good data and with bytes spoiled.
+ */
+static int cmp_test(patcmpfn_t cfn, patcmpfn_t cref, patfn_t ref)
+{
+    static unsigned char refbuf[MAXLEN + MAXPATBYTES];
+    unsigned char *buf;
+    pattern_t p;
+    size_t first;
+    int plen, off, len, phase, rc = 0;
+
+    if (!(buf = alloc_buffer(MAXLEN + 64)))
+        return 1;
+    for (plen = 1; plen <= MAXPATBYTES && rc == 0; plen++) {
+        make_pat(&p, plen);
+        ref(refbuf, p, sizeof(refbuf));
+        for (off = 0; off < 64 && rc == 0; off++) {
+            phase = (off * 5) % plen;
+            for (len = 0; len <= MAXLEN && rc == 0;
+                 len += len < 256 ? 1 : 13) {
+                memcpy(buf + off, refbuf + phase, len);
+                if (cfn(buf + off, p, phase, len, &first) != 0)
+                    rc = 1;
+                if (len == 0)
+                    continue;
+                buf[off + len * 5 / 7] ^= 0x10;
+                buf[off + len - 1] ^= 0xff;
+                rc |= cmp_check(cfn, cref, buf + off, p, phase, len);
+            }
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/* Same for a buffer above the non-temporal store threshold.
+ */
+static int big_test(patfn_t fn, patfn_t ref, patcmpfn_t cfn)
+{
+    unsigned char *buf, *refbuf;
+    pattern_t p;
+    size_t first = 0;
+    int plen, rc = 0;
+
+    if (!(buf = alloc_buffer(BIGLEN + 2)) || !(refbuf = malloc(BIGLEN)))
+        return 1;
+    for (plen = 1; plen <= MAXPATBYTES && rc == 0; plen++) {
+        make_pat(&p, plen);
+        ref(refbuf, p, BIGLEN);
+        buf[BIGLEN + 1] = GUARD;
+        fn(buf + 1, p, BIGLEN);
+        if (memcmp(buf + 1, refbuf, BIGLEN) != 0 || buf[BIGLEN + 1] != GUARD)
+            rc = 1;
+        if (cfn(buf + 1, p, 0, BIGLEN, &first) != 0)
+            rc = 1;
+        buf[1 + BIGLEN / 2] ^= 1;
+        buf[BIGLEN] ^= 1;
+        if (cfn(buf + 1, p, 0, BIGLEN, &first) != 2 || first != BIGLEN / 2)
+            rc = 1;
+    }
+    free(refbuf);
+    free(buf);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    patfn_t fn, ref = pat_lookup("ref");
+    patcmpfn_t cfn, cref = patcmp_lookup("ref");
+    char *name = argc > 1 ? argv[1] : "ref";
+
+    prog = basename(argv[0]);
+
+    if (!(fn = pat_lookup(name)) || !(cfn = patcmp_lookup(name))) {
+        fprintf(stderr, "%s: %s kernel not available\n", prog, name);
+        exit(77);
+    }
+
+    printf(" pattern fill vs reference (%s): %s\n", name,
+           small_test(fn, ref) ? "failed!" : "passed.");
+    printf(" pattern compare vs reference (%s): %s\n", name,
+           cmp_test(cfn, cref, ref) ? "failed!" : "passed.");
+    printf(" large pattern fill and compare vs reference (%s): %s\n", name,
+           big_test(fn, ref, cfn) ? "failed!" : "passed.");
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,71 @@
+/************************************************************\
+ * Copyright 2001 The Regents of the University of California.
+ * Copyright 2007 Lawrence Livermore National Security, LLC.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of Scrub.
+ * For details, see https://github.com/chaos/scrub.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* slowio - LD_PRELOAD shim that turns a fast target into a slow one
+ *
+ * The first SLOWIO_AFTER writes to descriptors other than stdin, stdout
+ * and stderr go straight through; each one after that sleeps SLOWIO_USEC
+ * microseconds first.  t35 uses this to watch the adaptive random data
+ * threads start while the device keeps up and park once it falls behind.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+static long after = 0;
+static long usec = 0;
+static long writes = 0;
+
+static void __attribute__((constructor))
+slowio_init(void)
+{
+    char *s;
+
+    if ((s = getenv("SLOWIO_AFTER")))
+        after = strtol(s, NULL, 10);
+    if ((s = getenv("SLOWIO_USEC")))
+        usec = strtol(s, NULL, 10);
+}
+
+static void
+slowio(int fd)
+{
+    if (fd > 2 && __sync_fetch_and_add(&writes, 1) >= after && usec > 0)
+        usleep(usec);
+}
+
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+    slowio(fd);
+    return syscall(SYS_write, fd, buf, count);
+}
+
+ssize_t
+pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    slowio(fd);
+    return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+ssize_t
+pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+    slowio(fd);
+    return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -32,6 +32,11 @@ main(int argc, char *argv[])
 
     printf("foo  ");
     progress_create(&p, 70);
+    if (argc > 1) {     /* give up halfway and start the bar over */
+        for (i = 1; i <= 50000000L; i++)
+            progress_update(p, (double)i/100000000L);
+        progress_reset(p, "foo  ");
+    }
     for (i = 1; i <= 100000000L; i++)
         progress_update(p, (double)i/100000000L);
     progress_destroy(p);
@@ -12,14 +12,87 @@
 #if HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include <sys/types.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "util.h"
 #include "genrand.h"
 
 char *prog;
 
+#define SEEKSIZE    (1024*1024 + 17)
+
+/* Check that the stream generated in odd-sized pieces at explicit
+ * offsets, or sequentially with genrand(), matches one big request.
+ * 'rng' optionally selects the generator, as for set_rng().
+ */
+static void
+seektest(char *rng)
+{
+    static unsigned char ref[SEEKSIZE], buf[SEEKSIZE];
+    static int pieces[] = { 1, 15, 16, 17, 4096, 33, 65536, 7, 0 };
+    off_t off;
+    int i, len;
+
+    disable_hwrand();
+    if (rng && set_rng(rng) < 0) {
+        perror(rng);
+        exit(77); /* not in this build or on this CPU */
+    }
+    if (initrand() < 0) {
+        perror("initrand");
+        exit(1);
+    }
+    if (genrand_at(ref, SEEKSIZE, 0) < 0) {
+        perror("genrand_at");
+        exit(1);
+    }
+    for (off = 0, len = 0; off < SEEKSIZE; off++)
+        if (ref[off] == 0)
+            len++;
+    if (len > SEEKSIZE / 128) {
+        printf("seek: too many zero bytes!\n");
+        exit(1);
+    }
+    for (off = 0, i = 0; off < SEEKSIZE; off += len, i++) {
+        len = pieces[i % 8];
+        if (len > SEEKSIZE - off)
+            len = SEEKSIZE - off;
+        genrand_at(&buf[off], len, off);
+    }
+    if (memcmp(ref, buf, SEEKSIZE) != 0) {
+        printf("seek: failed!\n");
+        exit(1);
+    }
+    memset(buf, 0, SEEKSIZE);
+    for (off = SEEKSIZE, i = 0; off > 0; off -= len, i++) {
+        len = pieces[i % 8];
+        if (len > off)
+            len = off;
+        genrand_at(&buf[off - len], len, off - len);
+    }
+    if (memcmp(ref, buf, SEEKSIZE) != 0) {
+        printf("seek: reverse failed!\n");
+        exit(1);
+    }
+    memset(buf, 0, SEEKSIZE);
+    for (off = 0, i = 0; off < SEEKSIZE; off += len, i++) {
+        len = pieces[i % 8];
+        if (len > SEEKSIZE - off)
+            len = SEEKSIZE - off;
+        genrand(&buf[off], len);
+    }
+    if (memcmp(ref, buf, SEEKSIZE) != 0) {
+        printf("seek: sequential failed!\n");
+        exit(1);
+    }
+    printf("seek: passed.\n");
+    exit(0);
+}
+
 int main(int argc, char *argv[])
 {
     unsigned char buf[24];
@@ -27,12 +100,18 @@ int main(int argc, char *argv[])
 
     prog = basename(argv[0]);
 
+    if (argc > 1 && !strcmp(argv[1], "seek"))
+        seektest(argc > 2 ? argv[2] : NULL);
+
     if (initrand() < 0) {
         perror("initrand");
         exit(1);
     }
     for (j = 0; j < 20; j++) {
-        genrand(buf, 24);
+        if (genrand(buf, 24) < 0) {
+            perror("genrand");
+            exit(1);
+        }
         for (i = 0; i < 24; i++)
             printf("%-.2hhx", buf[i]);
         printf("\n");